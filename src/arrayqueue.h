@@ -9,13 +9,16 @@
 #ifndef ARRAYQUEUE_H
 #define ARRAYQUEUE_H 
 
-#define AQ_DEFINE_STRUCT(struct_name, node_type) \
-struct struct_name {                             \
+#define AQ_STRUCT_FIELDS(node_type)              \
     node_type *nodes;                            \
     size_t     size;                             \
     size_t     used;                             \
     off_t      front;                            \
-    off_t      rear;                             \
+    off_t      rear;
+
+#define AQ_DEFINE_STRUCT(struct_name, node_type) \
+struct struct_name {                             \
+    AQ_STRUCT_FIELDS(node_type)                  \
 }
 
 #define AQ_NODES_FREE(q) ( (q)->size - (q)->used )
@@ -28,6 +31,9 @@ struct struct_name {                             \
 #define AQ_FRONT_(q)     ( (q)->nodes + (q)->front )
 #define AQ_FRONT(q)      ( AQ_FULL(q) ? NULL : AQ_FRONT_(q) )
 
+#define AQ_LAST_(q)      ( (q)->nodes + ( (q)->front + (q)->size - 1 ) % (q)->size )
+#define AQ_NTH_(q, i)    ( (q)->nodes + ( (q)->rear + (i) ) % (q)->size )
+
 #define AQ_DEQ_FIN(q)    ( (q)->rear  = ( (q)->rear  + 1 ) % (q)->size, (q)->used-- )
 #define AQ_ENQ_FIN(q)    ( (q)->front = ( (q)->front + 1 ) % (q)->size, (q)->used++ )
 
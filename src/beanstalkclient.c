@@ -36,6 +36,12 @@
  * =====================================================================================
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
+
 #ifdef __cplusplus
     extern "C" {
 #endif
@@ -48,29 +54,60 @@
 #include <stdio.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <sockutils.h>
 #include "beanstalkclient.h"
 #include "beanstalkproto.h"
 #include "cbq.h"
 #include "ivector.h"
+#include "uring.h"
 
 #define CONST_STRLEN(str) (sizeof(str)/sizeof(char)-1)
 
 #define ENQ_CMD_(client, gen_cmd, nodes, u_cb, ...) (                                       \
-    BSC_BUFFER_NODES_FREE(client) < (nodes) ? BSC_ERROR_QUEUE_FULL                          \
+    !queue_room((client), 1, (nodes))                                                       \
+    ? BSC_ERROR_QUEUE_FULL                                                                  \
     : ( ( AQ_FRONT_((client)->cbqueue)->data                                                \
-        = gen_cmd( &(AQ_FRONT_((client)->cbqueue)->len),                                    \
+        = gen_cmd( cbq_cmd_reserve((client)->cbqueue),                                      \
+            &(AQ_FRONT_((client)->cbqueue)->len),                                           \
             &(AQ_FRONT_((client)->cbqueue)->is_allocated), ## __VA_ARGS__) ) == NULL        \
         ? BSC_ERROR_MEMORY                                                                  \
-        : ( ioq_enq_( (client)->outq, AQ_FRONT_((client)->cbqueue)->data,                   \
-                    AQ_FRONT_((client)->cbqueue)->len, false ),                             \
+        : ( CBQ_CMD_COMMIT((client)->cbqueue, AQ_FRONT_((client)->cbqueue)),                \
+            AQ_FRONT_((client)->cbqueue)->out_start = (client)->outq->bytes_queued,         \
+            outq_enq_cmd( (client), AQ_FRONT_((client)->cbqueue)->data,                     \
+                    AQ_FRONT_((client)->cbqueue)->len ),                                    \
+            AQ_FRONT_((client)->cbqueue)->out_end = (client)->outq->bytes_queued,           \
               AQ_FRONT_((client)->cbqueue)->cb             = u_cb,                          \
               AQ_FRONT_((client)->cbqueue)->bytes_expected = 0,                             \
-              AQ_FRONT_((client)->cbqueue)->outq_offset    = (nodes) - 1,                   \
+              AQ_FRONT_((client)->cbqueue)->responses_left = 0,                             \
               BSC_ERROR_NONE ) ) )
 
 #define ENQ_CMD(client, cmd, u_cb, ...) ENQ_CMD_(client, bsp_gen_ ## cmd ## _cmd, 1, u_cb, ## __VA_ARGS__)
 
+/* 
+ * the data of a put with a release callback is handed back once written and data spliced
+ * from a pipe is gone once the first byte was sent, such puts can not be resent.
+ */
+#define PUT_BODY_END(node) ( (node)->out_end - CONST_STRLEN(CRLF) )
+
+#define PUT_RELEASED(client, node)                                                          \
+    ( (node)->cb == got_put_res                                                             \
+      && ( ( (node)->cb_data->put_info.request.release != NULL                              \
+             && (client)->outq->bytes_written >= PUT_BODY_END(node) )                       \
+        || ( (node)->cb_data->put_info.request.fd >= 0                                      \
+             && (node)->cb_data->put_info.request.offset < 0                                \
+             && (client)->outq->bytes_written > PUT_BODY_END(node) - (node)->cb_data->put_info.request.bytes ) ) )
+
+/* the body of the current response goes to a user buffer (or spill file) or is discarded, not into the vector */
+#define BODY_PLACED(client) ( (client)->body_dst != NULL || (client)->body_discard )
+
+/* a body over the input limits is passed to its response function as NULL */
+#define BODY_DISCARDED(info, data) \
+    ( (data) == NULL ? ( (info)->response.code = BSC_RES_CLIENT_TOO_LARGE, true ) : false )
+
 #define GENERIC_RES_FUNC(cmd_type) \
 static void got_ ## cmd_type ## _res(bsc *client, cbq_node *node, const char *data, size_t len)     \
 {                                                                                                   \
@@ -80,11 +117,64 @@ static void got_ ## cmd_type ## _res(bsc *client, cbq_node *node, const char *da
     }                                                                                               \
 }
 
+/* the line feeds of a received chunk, in batches of offsets from base (offsets are from the start of the chunk) */
+struct lf_index {
+    size_t pos[BSP_LF_BATCH];
+    size_t count;
+    size_t next;
+    size_t base;
+    size_t scanned;
+};
+
+/* 
+ * an io_uring request is tagged with its client and which of its (at most one) read and write it is,
+ * client pointers are aligned so the low bits are free
+ */
+#define BSC_URING_RECV  1
+#define BSC_URING_WRITE 2
+
+#define BSC_URING_DATA(client, op)  ( (uint64_t)(uintptr_t)(client) | (op) )
+#define BSC_URING_CLIENT(data)      ( (bsc *)(uintptr_t)( (data) & ~(uint64_t)3 ) )
+#define BSC_URING_OP(data)          ( (unsigned)( (data) & 3 ) )
+/* the nodes of a single write, the rest go out with the next run */
+#define BSC_URING_IOV   64
+
+struct bsc_uring_cqe {
+    uint64_t data;
+    int      res;
+};
+
+struct _bsc_uring {
+    uring   *ring;
+    bsc     *clients;           /* attached clients, linked through uring_next */
+    size_t   clients_count;
+    size_t   in_flight;
+    /* completions of other clients reaped while detaching one, dispatched by the next bsc_uring_run */
+    struct bsc_uring_cqe *deferred;
+    size_t   deferred_count;
+};
+
 static bool insert_tube_before(const char *name, struct bsc_tube_list **l);
 static bool insert_tube_after(const char *name, struct bsc_tube_list *l);
-static void outq_shift(ioq *q, ptrdiff_t s);
+static bool queue_room(bsc *client, size_t cmds, size_t nodes);
+static void queue_check(bsc *client);
+static ssize_t read_responses(bsc *client, size_t *responses);
+static bool read_room(bsc *client);
+static unsigned read_iov(bsc *client, struct iovec *iov);
+static ssize_t read_input(bsc *client, ssize_t bytes_total, size_t *responses);
+static ssize_t next_lf(struct lf_index *idx, const char *cur, size_t from, size_t len);
+static bool spill_body(bsc *client, size_t bytes);
+static void uring_queue(bsc_uring *ring, bsc *client);
+static void uring_complete(bsc_uring *ring, uint64_t data, int res);
+static void body_dst_reset(bsc *client);
+static void body_stream_chunk(bsc *client, const char *chunk, size_t len);
+static void outq_enq_cmd(bsc *client, char *data, size_t len);
+static char *outq_enq_put_body(bsc *client, cbq_node *node);
+static bool outq_replay(bsc *client, struct bsc_put_info **dropped, size_t *dropped_count);
 
 static void got_put_res(bsc *client, cbq_node *node, const char *data, size_t len);
+static void got_put_batch_res(bsc *client, cbq_node *node, const char *data, size_t len);
+static void got_ids_res(bsc *client, cbq_node *node, const char *data, size_t len);
 static void got_use_res(bsc *client, cbq_node *node, const char *data, size_t len);
 static void got_reserve_res(bsc *client, cbq_node *node, const char *data, size_t len);
 GENERIC_RES_FUNC(delete)
@@ -115,6 +205,8 @@ bsc *bsc_new(const char *host, const char *port, const char *default_tube,
         return NULL;
 
     client->buffer_fill_cb = NULL;
+    client->watermark_cb = NULL;
+    client->flush_timer_cb = NULL;
     client->pre_disconnect_cb = client->post_connect_cb = NULL;
     client->host = client->port = NULL;
     client->vec = NULL;
@@ -135,7 +227,8 @@ bsc *bsc_new(const char *host, const char *port, const char *default_tube,
     if ( ( client->cbqueue = cbq_new(buf_len) ) == NULL )
         goto evbuffer_new_err;
 
-    if ( ( client->outq = ioq_new(buf_len) ) == NULL )
+    /* a pending command never takes more than three nodes (put header, body and CRLF) */
+    if ( ( client->outq = ioq_new(buf_len * 3) ) == NULL )
         goto ioq_new_err;
 
     if ( ( client->default_tube = strdup(default_tube) ) == NULL )
@@ -149,11 +242,37 @@ bsc *bsc_new(const char *host, const char *port, const char *default_tube,
 
     client->watched_tubes->next = NULL;
 
+    client->vec_len     = vec_len;
     client->vec_min     = vec_min;
+    client->buf_len     = client->buf_max = buf_len;
+    client->buf_high    = client->buf_low = 0;
+    client->above_high  = false;
+    client->zerocopy_threshold = 0;
+    client->busy_poll_usec = 0;
     client->onerror     = onerror;
-    client->outq_offset = 0;
     client->watched_tubes_count = 1;
     client->state = BSC_STATE_DISCONNECTED;
+    client->corked = false;
+    client->eager_write = false;
+    client->flush_bytes = client->flush_cmds = SIZE_MAX;
+    client->flush_usec  = 0;
+    client->flush_timer_armed = false;
+    client->read_drain  = client->read_more = false;
+    client->read_max_bytes = client->read_max_responses = SIZE_MAX;
+    client->body_dst    = NULL;
+    client->body_dst_left = 0;
+    client->body_discard = false;
+    client->body_in_cb  = false;
+    client->body_tail   = 0;
+    client->body_stream = NULL;
+    client->idle_trim   = false;
+    client->vec_max     = client->body_max = SIZE_MAX;
+    client->spill_threshold = 0;
+    client->spill_fd    = -1;
+    client->uring       = NULL;
+    client->uring_next  = NULL;
+    client->uring_wiov  = NULL;
+    client->uring_ops   = client->uring_stale = 0;
 
     if ( !bsc_connect(client, errorstr) )
         goto connect_err;
@@ -184,10 +303,49 @@ host_strdup_err:
     return NULL;
 }
 
+void bsc_set_buffer_limits(bsc *client, size_t max_len, size_t high, size_t low, bsc_watermark_cb watermark_cb)
+{
+    client->buf_max      = max_len > client->buf_len ? max_len : client->buf_len;
+    client->buf_high     = high;
+    client->buf_low      = low;
+    client->watermark_cb = watermark_cb;
+}
+
+void bsc_set_input_limits(bsc *client, size_t vec_max, size_t body_max)
+{
+    client->vec_max  = vec_max  ? ( vec_max > client->vec->size ? vec_max : client->vec->size ) : SIZE_MAX;
+    client->body_max = body_max ? body_max : SIZE_MAX;
+}
+
+bool bsc_trim(bsc *client)
+{
+    /* a pending response would only grow the buffers back */
+    if ( !AQ_EMPTY(client->cbqueue) || !AQ_EMPTY(client->outq) || client->tubeq != NULL
+      || ( client->tubecbq != NULL && !AQ_EMPTY(client->tubecbq) )
+      || client->body_dst != NULL || client->body_discard || client->uring_ops )
+        return false;
+
+    if ( client->cbqueue->size > client->buf_len && !cbq_resize(client->cbqueue, client->buf_len) )
+        return false;
+
+    if ( client->outq->size > client->buf_len * 3 && !ioq_resize(client->outq, client->buf_len * 3) )
+        return false;
+
+    return ivector_shrink(client->vec, client->vec_len);
+}
+
+void bsc_set_idle_trim(bsc *client, bool idle_trim)
+{
+    client->idle_trim = idle_trim;
+}
+
 void bsc_free(bsc *client)
 {
+    if (client->uring != NULL)
+        bsc_uring_detach(client);
     if (client->state == BSC_STATE_CONNECTED)
         bsc_disconnect(client);
+    body_dst_reset(client);
 
     struct bsc_tube_list *p1 = client->watched_tubes, *p2 = NULL;
 
@@ -209,12 +367,15 @@ void bsc_free(bsc *client)
 
 bool bsc_connect(bsc *client, char *errorstr)
 {
-    ptrdiff_t queue_diff;
     bool      check_default    = true, ignore_default = true;
     struct    bsc_tube_list *p = NULL;
     ioq      *tmpq             = NULL;
     cbq      *tmpcbq           = NULL;
+    struct    bsc_put_info *dropped = NULL;
+    size_t    dropped_count    = 0, i;
     int       cmp_res;
+    bsc_watermark_cb watermark_cb = client->watermark_cb;
+    bsc_flush_timer_cb flush_timer_cb = client->flush_timer_cb;
 
     if ( ( client->fd = tcp_client(client->host, client->port, errorstr) ) == SOCK_ERR )
         return false;
@@ -224,12 +385,19 @@ bool bsc_connect(bsc *client, char *errorstr)
         return false;
     }
 
-    // caculate the shift between outq and cbqueue
-    queue_diff = client->outq_offset + (client->cbqueue->used - client->outq->used);
-    outq_shift(client->outq, -1 * queue_diff);
+    if (client->zerocopy_threshold)
+        ioq_zerocopy(client->outq, set_zerocopy(client->fd, NULL) ? client->zerocopy_threshold : 0);
+
+    if (client->busy_poll_usec)
+        set_busy_poll(client->fd, client->busy_poll_usec, NULL);
+
+    // rebuild the outgoing queue from the commands that are still waiting for a response
+    if (!outq_replay(client, &dropped, &dropped_count))
+        goto out_of_memory;
 
-    // reset the input vector (buffer)
+    // reset the input vector (buffer), a body that was cut off is received again
     client->vec->som = client->vec->eom = client->vec->data;
+    body_dst_reset(client);
 
     if (client->tubeq != NULL)
         ioq_free(client->tubeq);
@@ -246,6 +414,10 @@ bool bsc_connect(bsc *client, char *errorstr)
 
     // move the outgoing callback queue to a tmp queue
     tmpcbq = client->cbqueue;
+
+    // the tube commands do not count as pending commands and are not held back
+    client->watermark_cb = NULL;
+    client->flush_timer_cb = NULL;
     
     // create a new outgoing callback queue for watching, using and ignoring tubes
     if ( ( client->cbqueue = cbq_new(client->watched_tubes_count + 2) ) == NULL )
@@ -274,15 +446,29 @@ bool bsc_connect(bsc *client, char *errorstr)
     client->outq    = tmpq;
     client->tubecbq = client->cbqueue;
     client->cbqueue = tmpcbq;
+    client->watermark_cb = watermark_cb;
+    client->flush_timer_cb = flush_timer_cb;
 
     client->state = BSC_STATE_CONNECTED;
 
+    // complete the puts that could not be resent
+    for (i = 0; i < dropped_count; ++i) {
+        dropped[i].response.code = BSC_RES_CLIENT_DISCONNECTED;
+        if (dropped[i].user_cb != NULL)
+            dropped[i].user_cb(client, dropped + i);
+    }
+    free(dropped);
+    queue_check(client);
+
     if (client->post_connect_cb != NULL)
         client->post_connect_cb(client);
 
     return true;
 
 out_of_memory:
+    client->watermark_cb = watermark_cb;
+    client->flush_timer_cb = flush_timer_cb;
+    free(dropped);
     if (errorstr != NULL)
         strcpy(errorstr, "out of memory");
     return false; 
@@ -290,8 +476,19 @@ out_of_memory:
 
 void bsc_disconnect(bsc *client)
 {
+    struct linger abort_close = { 1, 0 };
+
     if (client->pre_disconnect_cb != NULL)
         client->pre_disconnect_cb(client);
+
+    /* reset the connection so the kernel drops the pages it still reads from, they are released next */
+    if ( client->outq->zcq != NULL && !AQ_EMPTY(client->outq->zcq) )
+        setsockopt(client->fd, SOL_SOCKET, SO_LINGER, &abort_close, sizeof(abort_close));
+    /* requests in flight hold on to the socket, they complete once it is shut down and are then ignored */
+    if (client->uring_ops) {
+        shutdown(client->fd, SHUT_RDWR);
+        client->uring_stale = client->uring_ops;
+    }
     while ( close(client->fd) == SOCK_ERR && errno != EBADF ) ;
     client->state = BSC_STATE_DISCONNECTED;
 }
@@ -304,9 +501,15 @@ bool bsc_reconnect(bsc *client, char *errorstr)
 
 void bsc_write(bsc *client)
 {
-    cbq_node *node = NULL;
-    size_t  i;
-    ssize_t nodes_written;
+    ssize_t nodes_written = 0;
+
+    if (client->outq->zcq != NULL)
+        ioq_zerocopy_reap(client->outq, client->fd);
+
+    /* the io_uring engine is writing the head of the queue */
+    if ( client->corked || (client->uring_ops & BSC_URING_WRITE) )
+        return;
+
     if (client->tubeq != NULL) {
         nodes_written = ioq_dump(client->tubeq, client->fd);
         if (AQ_EMPTY(client->tubeq)) {
@@ -314,7 +517,9 @@ void bsc_write(bsc *client)
             client->tubeq = NULL;
         }
     }
-    else
+
+    /* the restored tubes must go out first, the rest follows in the same pass */
+    if (client->tubeq == NULL && nodes_written >= 0)
         nodes_written = ioq_dump(client->outq, client->fd);
 
     if (nodes_written < 0)
@@ -328,19 +533,464 @@ void bsc_write(bsc *client)
                 /* unexpected socket error - yield client callback */
                 client->state = BSC_STATE_DISCONNECTED;
                 client->onerror(client, BSC_ERROR_SOCKET);
+                return;
         }
-    else
-        for (i = 0; nodes_written-- > 0; ++i) {
-            node = client->cbqueue->nodes + ((client->cbqueue->rear + i) % client->cbqueue->size);
-            while (node->outq_offset > 0) {
-                --nodes_written;
-                --node->outq_offset;
-                ++client->outq_offset;
+
+    queue_check(client);
+}
+
+size_t bsc_cmds_in_flight(bsc *client)
+{
+    cbq   *q = client->cbqueue;
+    size_t lo = 0, hi = q->used, mid;
+
+    while (lo < hi) {
+        mid = lo + ( hi - lo ) / 2;
+        if ( CBQ_NODE_WRITTEN(AQ_NTH_(q, mid), client->outq->bytes_written) )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+void bsc_set_eager_write(bsc *client, bool eager_write)
+{
+    client->eager_write = eager_write;
+}
+
+void bsc_cork(bsc *client)
+{
+    client->corked = true;
+}
+
+void bsc_uncork(bsc *client)
+{
+    bool corked_sock;
+
+    client->corked = false;
+    if ( AQ_EMPTY(client->outq) && client->tubeq == NULL )
+        return;
+
+    /* the last partial segment goes out when the socket is uncorked */
+    corked_sock = set_cork(client->fd, 1, NULL);
+    bsc_write(client);
+    if (corked_sock)
+        set_cork(client->fd, 0, NULL);
+
+    if ( client->buffer_fill_cb != NULL && ( !AQ_EMPTY(client->outq) || client->tubeq != NULL ) )
+        client->buffer_fill_cb(client);
+}
+
+void bsc_set_flush_policy(bsc *client, size_t bytes, size_t cmds, unsigned long usec,
+                          bsc_flush_timer_cb flush_timer_cb)
+{
+    client->flush_bytes    = bytes ? bytes : SIZE_MAX;
+    client->flush_cmds     = cmds  ? cmds  : SIZE_MAX;
+    client->flush_usec     = usec;
+    client->flush_timer_cb = flush_timer_cb;
+}
+
+void bsc_flush_timeout(bsc *client)
+{
+    client->flush_timer_armed = false;
+    if ( client->state != BSC_STATE_CONNECTED || client->corked )
+        return;
+
+    bsc_write(client);
+    if ( client->state == BSC_STATE_CONNECTED && client->buffer_fill_cb != NULL
+      && ( !AQ_EMPTY(client->outq) || client->tubeq != NULL ) )
+        client->buffer_fill_cb(client);
+}
+
+bool bsc_set_busy_poll(bsc *client, int usec)
+{
+    client->busy_poll_usec = usec;
+
+    /* a disconnected client sets the socket option when it connects */
+    return client->state != BSC_STATE_CONNECTED || set_busy_poll(client->fd, usec, NULL);
+}
+
+bool bsc_set_zerocopy(bsc *client, size_t threshold)
+{
+    client->zerocopy_threshold = threshold;
+
+    /* a disconnected client sets the socket option when it connects */
+    if ( threshold && client->state == BSC_STATE_CONNECTED && !set_zerocopy(client->fd, NULL) ) {
+        ioq_zerocopy(client->outq, 0);
+        return false;
+    }
+
+    return ioq_zerocopy(client->outq, threshold);
+}
+
+#define TIMESPEC_USEC(ts) ( (uint64_t)(ts).tv_sec * 1000000 + (ts).tv_nsec / 1000 )
+
+size_t bsc_poll_spin(bsc *client, unsigned long budget_us)
+{
+    struct timespec now;
+    uint64_t deadline;
+    size_t   responses = 0;
+    ssize_t  bytes_recv;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = TIMESPEC_USEC(now) + budget_us;
+
+    if (client->outq->zcq != NULL)
+        ioq_zerocopy_reap(client->outq, client->fd);
+
+    do {
+        if ( client->tubeq != NULL || !AQ_EMPTY(client->outq) )
+            bsc_write(client);
+        if (client->state != BSC_STATE_CONNECTED)
+            return 0;
+
+        if ( ( bytes_recv = read_responses(client, &responses) ) == 0 )
+            return 0;
+        if ( bytes_recv > 0 && responses )
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while ( TIMESPEC_USEC(now) < deadline && client->state == BSC_STATE_CONNECTED );
+
+    queue_check(client);
+    return responses;
+}
+
+bsc_uring *bsc_uring_new(unsigned entries, char *errorstr)
+{
+    bsc_uring *ring = NULL;
+
+    if ( ( ring = (bsc_uring *)malloc(sizeof(bsc_uring)) ) == NULL )
+        goto malloc_err;
+
+    if ( ( ring->ring = uring_new(entries) ) == NULL ) {
+        if (errorstr != NULL)
+            snprintf(errorstr, BSC_ERRSTR_LEN, "io_uring_setup: %s", strerror(errno));
+        free(ring);
+        return NULL;
+    }
+
+    ring->clients        = NULL;
+    ring->clients_count  = ring->in_flight = 0;
+    ring->deferred       = NULL;
+    ring->deferred_count = 0;
+
+    return ring;
+
+malloc_err:
+    if (errorstr != NULL)
+        strcpy(errorstr, "out of memory");
+    return NULL;
+}
+
+void bsc_uring_free(bsc_uring *ring)
+{
+    while (ring->clients != NULL)
+        bsc_uring_detach(ring->clients);
+
+    uring_free(ring->ring);
+    free(ring->deferred);
+    free(ring);
+}
+
+bool bsc_uring_attach(bsc_uring *ring, bsc *client)
+{
+    struct bsc_uring_cqe *deferred = NULL;
+
+    if (client->uring != NULL)
+        return client->uring == ring;
+
+    /* a detach may have to set aside the completions of all the other clients, two each */
+    if ( ( deferred = (struct bsc_uring_cqe *)realloc(ring->deferred,
+            sizeof(struct bsc_uring_cqe) * 2 * ( ring->clients_count + 1 )) ) == NULL )
+        return false;
+
+    ring->deferred = deferred;
+
+    if ( ( client->uring_wiov = (struct iovec *)malloc(sizeof(struct iovec) * BSC_URING_IOV) ) == NULL )
+        return false;
+
+    ++ring->clients_count;
+
+    client->uring      = ring;
+    client->uring_next = ring->clients;
+    ring->clients      = client;
+
+    return true;
+}
+
+void bsc_uring_detach(bsc *client)
+{
+    bsc_uring *ring = client->uring;
+    bsc      **p    = NULL;
+    struct bsc_uring_cqe cqe;
+    size_t     i;
+
+    if (ring == NULL)
+        return;
+
+    /* completions set aside by an earlier detach */
+    for (i = ring->deferred_count; i-- > 0; )
+        if (BSC_URING_CLIENT(ring->deferred[i].data) == client) {
+            cqe = ring->deferred[i];
+            ring->deferred[i] = ring->deferred[--ring->deferred_count];
+            uring_complete(ring, cqe.data, cqe.res);
+        }
+
+    /* a read waits for a response that may never come, both are cancelled unless they already completed */
+    if (client->uring_ops & BSC_URING_RECV)
+        uring_cancel(ring->ring, BSC_URING_DATA(client, BSC_URING_RECV));
+    if (client->uring_ops & BSC_URING_WRITE)
+        uring_cancel(ring->ring, BSC_URING_DATA(client, BSC_URING_WRITE));
+
+    while (client->uring_ops) {
+        if ( uring_enter(ring->ring, 1) < 0 && errno != EINTR )
+            break;
+        while ( client->uring_ops && uring_reap(ring->ring, &cqe.data, &cqe.res) ) {
+            if (cqe.data == 0)
+                continue;
+            if (BSC_URING_CLIENT(cqe.data) == client)
+                uring_complete(ring, cqe.data, cqe.res);
+            else
+                ring->deferred[ring->deferred_count++] = cqe;
+        }
+    }
+
+    for (p = &ring->clients; *p != client; p = &(*p)->uring_next) ;
+    *p = client->uring_next;
+    --ring->clients_count;
+
+    client->uring      = NULL;
+    client->uring_next = NULL;
+    free(client->uring_wiov);
+    client->uring_wiov = NULL;
+}
+
+int bsc_uring_run(bsc_uring *ring, int timeout_ms)
+{
+    bsc     *client = NULL, *next = NULL;
+    struct bsc_uring_cqe cqe;
+    int      completed = 0;
+    bool     wait;
+
+    for (client = ring->clients; client != NULL; client = next) {
+        next = client->uring_next;
+        uring_queue(ring, client);
+    }
+
+    /* the requests of all the clients go out with a single system call, which also waits for the first completion */
+    wait = ring->in_flight && timeout_ms != 0 && ring->deferred_count == 0;
+    if ( wait && timeout_ms > 0 && !uring_timeout(ring->ring, timeout_ms) )
+        return -1;
+    if ( ( wait || ring->ring->sq_pending ) && uring_enter(ring->ring, wait ? 1 : 0) < 0 && errno != EINTR )
+        return -1;
+
+    while (ring->deferred_count) {
+        cqe = ring->deferred[--ring->deferred_count];
+        uring_complete(ring, cqe.data, cqe.res);
+        ++completed;
+    }
+
+    while ( uring_reap(ring->ring, &cqe.data, &cqe.res) ) {
+        /* timeouts and cancels */
+        if (cqe.data == 0)
+            continue;
+        uring_complete(ring, cqe.data, cqe.res);
+        ++completed;
+    }
+
+    return completed;
+}
+
+/* submits the client's next write and read, at most one of each is in flight */
+static void uring_queue(bsc_uring *ring, bsc *client)
+{
+    size_t   nodes;
+    unsigned iovcnt;
+
+    if (client->state != BSC_STATE_CONNECTED)
+        return;
+
+    if (client->outq->zcq != NULL)
+        ioq_zerocopy_reap(client->outq, client->fd);
+
+    if ( !(client->uring_ops & BSC_URING_WRITE) && !client->corked ) {
+        /* the tube commands restored on connect, files and zerocopy nodes are written the usual way */
+        if ( client->tubeq != NULL || ( !AQ_EMPTY(client->outq) && ioq_gather(client->outq) == 0 ) )
+            bsc_write(client);
+
+        /* the iovecs are copied, a callback of a client queued later may resize this outq before the ring is entered */
+        if ( client->state == BSC_STATE_CONNECTED && client->tubeq == NULL
+          && ( nodes = ioq_gather(client->outq) ) > 0 ) {
+            if (nodes > BSC_URING_IOV)
+                nodes = BSC_URING_IOV;
+            memcpy(client->uring_wiov, IOQ_REAR_(client->outq), sizeof(struct iovec) * nodes);
+            if ( uring_writev(ring->ring, client->fd, client->uring_wiov, nodes, BSC_URING_DATA(client, BSC_URING_WRITE)) ) {
+                client->uring_ops |= BSC_URING_WRITE;
+                ++ring->in_flight;
             }
         }
+    }
+
+    /* the socket is only read while a response is expected, an idle client holds no request (and can be trimmed) */
+    if ( !(client->uring_ops & BSC_URING_RECV) && client->state == BSC_STATE_CONNECTED
+      && ( !AQ_EMPTY(client->cbqueue) || ( client->tubecbq != NULL && !AQ_EMPTY(client->tubecbq) ) )
+      && read_room(client) ) {
+        iovcnt = read_iov(client, client->uring_iov);
+        if ( uring_readv(ring->ring, client->fd, client->uring_iov, iovcnt, BSC_URING_DATA(client, BSC_URING_RECV)) ) {
+            client->uring_ops |= BSC_URING_RECV;
+            ++ring->in_flight;
+        }
+    }
+}
+
+/* a request of the client completed with res (bytes or -errno) */
+static void uring_complete(bsc_uring *ring, uint64_t data, int res)
+{
+    bsc     *client    = BSC_URING_CLIENT(data);
+    unsigned op        = BSC_URING_OP(data);
+    size_t   responses = 0;
+
+    client->uring_ops &= ~op;
+    --ring->in_flight;
+
+    /* the socket it was on was disconnected since */
+    if (client->uring_stale & op) {
+        client->uring_stale &= ~op;
+        return;
+    }
+
+    if (op == BSC_URING_RECV) {
+        /* a cancelled read is a temporary error, the next read (or bsc_read once detached) takes over */
+        if (res < 0)
+            errno = res == -ECANCELED ? EINTR : -res;
+        if (read_input(client, res < 0 ? SOCK_ERR : res, &responses) == 0)
+            return;
+    }
+    else if (res >= 0)
+        ioq_written(client->outq, res);
+    else if ( res != -EAGAIN && res != -EINTR && res != -ECANCELED ) {
+        /* unexpected socket error - yield client callback */
+        client->state = BSC_STATE_DISCONNECTED;
+        client->onerror(client, BSC_ERROR_SOCKET);
+        return;
+    }
+
+    queue_check(client);
+}
+
+void bsc_set_read_drain(bsc *client, bool drain, size_t max_bytes, size_t max_responses)
+{
+    client->read_drain         = drain;
+    client->read_max_bytes     = max_bytes     ? max_bytes     : SIZE_MAX;
+    client->read_max_responses = max_responses ? max_responses : SIZE_MAX;
 }
 
 void bsc_read(bsc *client)
+{
+    size_t  bytes = 0, responses = 0;
+    ssize_t bytes_recv;
+
+    /* completed zerocopy sends show up as an error (read) event */
+    if (client->outq->zcq != NULL)
+        ioq_zerocopy_reap(client->outq, client->fd);
+
+    client->read_more = false;
+    do {
+        if ( ( bytes_recv = read_responses(client, &responses) ) == 0 )
+            return;
+        if (bytes_recv == SOCK_ERR) {
+            if (errno == EINTR && client->read_drain)
+                continue;
+            break;
+        }
+        bytes += bytes_recv;
+    } while ( client->read_drain && client->state == BSC_STATE_CONNECTED
+           && bytes < client->read_max_bytes && responses < client->read_max_responses );
+
+    /* an edge triggered loop is not told again about what is left */
+    if ( client->read_drain && bytes_recv > 0 && client->state == BSC_STATE_CONNECTED )
+        client->read_more = true;
+
+    queue_check(client);
+}
+
+/* 
+ * one recv and the responses it completed.
+ * returns the bytes received, SOCK_ERR on a temporary error (errno is kept) or 0 when the client failed.
+ */
+static ssize_t read_responses(bsc *client, size_t *responses)
+{
+    struct iovec iov[2];
+    ssize_t      bytes_total;
+
+    /* the vector belongs to the read the io_uring engine has in flight */
+    if (client->uring_ops & BSC_URING_RECV) {
+        errno = EAGAIN;
+        return SOCK_ERR;
+    }
+
+    if (!read_room(client))
+        return 0;
+
+    if (read_iov(client, iov) == 2)
+        bytes_total = readv(client->fd, iov, 2);
+    else
+        bytes_total = recv(client->fd, iov[0].iov_base, iov[0].iov_len, 0);
+
+    return read_input(client, bytes_total, responses);
+}
+
+/* makes room in the vector for the next recv, false when the client failed or is out of memory (read_more is set) */
+static bool read_room(bsc *client)
+{
+    ivector *vec = client->vec;
+
+    /* reclaim the consumed bytes once the free tail runs low, expand the vector only if that is not enough */
+    if (IVECTOR_FREE(vec) < client->vec_min && vec->som != vec->data)
+        ivector_compact(vec);
+
+    if (IVECTOR_FREE(vec) < client->vec_min) {
+        if (vec->size >= client->vec_max) {
+            /* a response line longer than the limit */
+            if (IVECTOR_FREE(vec) == 0) {
+                client->state = BSC_STATE_DISCONNECTED;
+                client->onerror(client, BSC_ERROR_INPUT_LIMIT);
+                return false;
+            }
+        }
+        else if ( vec->size * 2 <= client->vec_max ? !ivector_expand(vec)
+                : !ivector_reserve(vec, client->vec_max - ( vec->som - vec->data )) ) {
+            /* temporary (out of memory) error, the callback will be rescheduled */
+            client->read_more = true;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* 
+ * where the next recv goes, the rest of a body that is placed in a user buffer is read straight into it,
+ * one that is discarded is received into the vector and skipped. returns the number of iovecs.
+ */
+static unsigned read_iov(bsc *client, struct iovec *iov)
+{
+    unsigned iovcnt = 0;
+
+    if (client->body_dst_left && !client->body_discard) {
+        iov[iovcnt].iov_base   = client->body_dst_pos;
+        iov[iovcnt++].iov_len  = client->body_dst_left;
+    }
+    iov[iovcnt].iov_base   = client->vec->eom;
+    iov[iovcnt++].iov_len  = IVECTOR_FREE(client->vec);
+
+    return iovcnt;
+}
+
+/* dispatches the responses completed by the bytes_total bytes a recv of read_iov returned */
+static ssize_t read_input(bsc *client, ssize_t bytes_total, size_t *responses)
 {
     /* variable declaration / initialization */
     ivector  *vec  = client->vec;
@@ -348,28 +998,39 @@ void bsc_read(bsc *client)
     cbq_node *node = NULL;
     char      ctmp, *eom  = NULL;
     ssize_t   bytes_recv, bytes_processed = 0;
+    size_t    body, placed;
+    ssize_t   lf;
+    struct lf_index lfs = { .count = 0, .next = 0, .base = 0, .scanned = 0 };
 
-    /* expand vector on demand */
-    if (IVECTOR_FREE(vec) < client->vec_min && !ivector_expand(vec))
-        /* temporary (out of memory) error, the callback will be rescheduled */
-        return;
-
-    /* recieve data */
-    if ( ( bytes_recv = recv(client->fd, vec->eom, IVECTOR_FREE(vec), 0) ) < 1 ) {
-        switch (bytes_recv) {
+    if (bytes_total < 1) {
+        switch (bytes_total) {
             case SOCK_ERR:
                 switch (errno) {
                     case EAGAIN:
                     case EINTR:
                         /* temporary error, the callback will be rescheduled */
-                        return;
+                        return SOCK_ERR;
                 }
             default:
                 /* unexpected socket error - reconnect */
                 client->state = BSC_STATE_DISCONNECTED;
                 client->onerror(client, BSC_ERROR_SOCKET);
-                return;
+                return 0;
+        }
+    }
+
+    bytes_recv = bytes_total;
+    if (client->body_dst_left) {
+        placed = (size_t)bytes_recv < client->body_dst_left ? (size_t)bytes_recv : client->body_dst_left;
+        client->body_dst_left -= placed;
+        bytes_recv            -= placed;
+        if (client->body_discard) {
+            if (client->body_stream != NULL)
+                body_stream_chunk(client, vec->eom, placed);
+            vec->eom = vec->som = vec->eom + placed;
         }
+        else
+            client->body_dst_pos += placed;
     }
 
     //printf("recv: '%s'\n", vec->eom);
@@ -387,42 +1048,130 @@ void bsc_read(bsc *client)
         if ( (node = AQ_REAR(buf) ) == NULL ) {
             /* critical error */
             client->onerror(client, BSC_ERROR_INTERNAL);
-            return;
+            return 0;
         }
-        if (node->bytes_expected) {
-            if ( bytes_recv - bytes_processed < node->bytes_expected + 2 - (vec->eom-vec->som) )
+        /* an empty streamed body still has its CRLF to come */
+        if ( node->bytes_expected || client->body_stream != NULL ) {
+            /* a body placed in a user buffer (or discarded) only leaves its CRLF in the vector */
+            body = BODY_PLACED(client) ? 0 : node->bytes_expected;
+            if ( client->body_dst_left || (size_t)( bytes_recv - bytes_processed ) < body + 2 - (vec->eom-vec->som) )
                 goto in_middle_of_msg;
 
-            eom = vec->som + node->bytes_expected;
+            eom = vec->som + body;
             bytes_processed += eom - vec->eom + 2;
-            if (node->cb != NULL) {
+            if (node->cb != NULL && BODY_PLACED(client))
+                node->cb(client, node, client->body_dst, node->bytes_expected);
+            else if (node->cb != NULL) {
                 *eom = '\0';
+                /* bsc_job_take only hands over the buffer while it holds the body */
+                client->body_in_cb = true;
+                client->body_tail  = bytes_recv - bytes_processed;
                 node->cb(client, node, vec->som, eom - vec->som);
+                client->body_in_cb = false;
             }
-            vec->eom = vec->som = eom + 2;
+            body_dst_reset(client);
+            /* the body was taken along with its buffer, the rest is moved to the spare */
+            if (vec->spare != NULL)
+                ivector_swap(vec, eom + 2, bytes_recv - bytes_processed);
+            else
+                vec->eom = vec->som = eom + 2;
             CBQ_DEQ_FIN(buf);
+            ++*responses;
         }
         else {
-            if ( ( eom = (char *)memchr(vec->eom, '\n', bytes_recv - bytes_processed) ) == NULL )
+            if ( ( lf = next_lf(&lfs, vec->eom, bytes_processed, bytes_recv) ) < 0 )
                 goto in_middle_of_msg;
 
+            eom = vec->eom + ( lf - bytes_processed );
+
             bytes_processed += ++eom - vec->eom;
             if (node->cb != NULL) {
                 ctmp = *eom;
                 *eom = '\0';
                 node->cb(client, node, vec->som, eom - vec->som);
                 *eom = ctmp;
+                /* the queue may have grown (and moved its nodes) in a user callback */
+                node = AQ_REAR_(buf);
             }
             vec->eom = vec->som = eom;
-            if (!node->bytes_expected)
+            /* a body over the limits is discarded (passed to the callback as NULL) */
+            if ( node->bytes_expected && client->body_dst == NULL
+              && ( node->bytes_expected > client->body_max || node->bytes_expected + 3 > client->vec_max ) ) {
+                client->body_discard  = true;
+                client->body_dst_left = node->bytes_expected;
+            }
+            if (node->bytes_expected && BODY_PLACED(client)) {
+                /* the body bytes that came with the header are the only ones copied */
+                placed = (size_t)( bytes_recv - bytes_processed );
+                if (placed > client->body_dst_left)
+                    placed = client->body_dst_left;
+                if (!client->body_discard) {
+                    memcpy(client->body_dst_pos, vec->eom, placed);
+                    client->body_dst_pos += placed;
+                }
+                client->body_dst_left -= placed;
+                bytes_processed       += placed;
+                if (client->body_stream != NULL)
+                    body_stream_chunk(client, vec->eom, placed);
+                vec->eom = vec->som    = vec->eom + placed;
+            }
+            /* 
+             * the room for a body (with CRLF and vec_min to spare so it is not expanded again) is made
+             * at once, on failure (or past the limit) the vector is expanded as it fills up
+             */
+            else if ( node->bytes_expected
+                   && vec->som - vec->data + node->bytes_expected + 2 + client->vec_min + 1 <= client->vec_max )
+                ivector_reserve(vec, node->bytes_expected + 2 + client->vec_min + 1);
+            else if ( !node->bytes_expected && !node->responses_left && client->body_stream == NULL )
                 CBQ_DEQ_FIN(buf);
+            ++*responses;
         }
     }
     vec->eom = vec->som = vec->data;
-    return;
+    return bytes_total;
 
 in_middle_of_msg:
     vec->eom += bytes_recv - bytes_processed;
+    return bytes_total;
+}
+
+static bsc_error_t enq_put(bsc            *client,
+                           bsc_put_user_cb user_cb,
+                           void           *user_data,
+                           uint32_t        priority,
+                           uint32_t        delay,
+                           uint32_t        ttr,
+                           size_t          bytes,
+                           const char     *data,
+                           int             fd,
+                           off_t           offset,
+                           bool            free_when_finished,
+                           bsc_release_cb  release,
+                           void           *release_ctx)
+{
+    bsc_error_t error;
+
+    if ( ( error = ENQ_CMD_(client, bsp_gen_put_hdr, 3, got_put_res, priority, delay, ttr, bytes) ) != BSC_ERROR_NONE )
+        return error;
+
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.user_data           = user_data;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.user_cb             = user_cb;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.priority    = priority;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.ttr         = ttr;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.delay       = delay;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.bytes       = bytes;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.data        = data;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.fd          = fd;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.offset      = offset;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.autofree    = free_when_finished;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.release     = release;
+    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.release_ctx = release_ctx;
+
+    outq_enq_put_body(client, AQ_FRONT_(client->cbqueue));
+
+    CBQ_ENQ_FIN(client);
+
+    return BSC_ERROR_NONE;
 }
 
 bsc_error_t bsc_put(bsc            *client,
@@ -435,34 +1184,142 @@ bsc_error_t bsc_put(bsc            *client,
                     const char     *data,
                     bool            free_when_finished)
 {
-    bsc_error_t error;
+    return enq_put(client, user_cb, user_data, priority, delay, ttr, bytes, data, -1, 0, free_when_finished, NULL, NULL);
+}
 
-    if ( ( error = ENQ_CMD_(client, bsp_gen_put_hdr, 3, got_put_res, priority, delay, ttr, bytes) ) != BSC_ERROR_NONE )
-        return error;
+bsc_error_t bsc_put_w_release(bsc            *client,
+                              bsc_put_user_cb user_cb,
+                              void           *user_data,
+                              uint32_t        priority,
+                              uint32_t        delay,
+                              uint32_t        ttr,
+                              size_t          bytes,
+                              const char     *data,
+                              bsc_release_cb  release,
+                              void           *release_ctx)
+{
+    return enq_put(client, user_cb, user_data, priority, delay, ttr, bytes, data, -1, 0, false, release, release_ctx);
+}
+
+bsc_error_t bsc_put_fd(bsc            *client,
+                       bsc_put_user_cb user_cb,
+                       void           *user_data,
+                       uint32_t        priority,
+                       uint32_t        delay,
+                       uint32_t        ttr,
+                       size_t          bytes,
+                       int             fd,
+                       off_t           offset,
+                       bsc_release_cb  release,
+                       void           *release_ctx)
+{
+    struct stat st;
 
-    ioq_enq_( client->outq, (char *)data, bytes, false );
-    ioq_enq_( client->outq, (char *)CRLF, CONST_STRLEN(CRLF), false );
+    /* sendfile reads a regular file and splice needs a pipe, either fails only after the header went out */
+    if ( fstat(fd, &st) == -1 || !( offset < 0 ? S_ISFIFO(st.st_mode) : S_ISREG(st.st_mode) ) )
+        return BSC_ERROR_BAD_FD;
 
-    AQ_FRONT_(client->cbqueue)->cb_data->put_info.user_data         = user_data;
-    AQ_FRONT_(client->cbqueue)->cb_data->put_info.user_cb           = user_cb;
-    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.priority  = priority;
-    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.ttr       = ttr;
-    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.delay     = delay;
-    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.bytes     = bytes;
-    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.data      = data;
-    AQ_FRONT_(client->cbqueue)->cb_data->put_info.request.autofree  = free_when_finished;
+    return enq_put(client, user_cb, user_data, priority, delay, ttr, bytes, NULL, fd, offset, false, release, release_ctx);
+}
 
-    CBQ_ENQ_FIN(client);
+bsc_error_t bsc_put_batch(bsc                  *client,
+                          bsc_put_batch_user_cb user_cb,
+                          void                 *user_data,
+                          struct bsc_put_job   *jobs,
+                          size_t                count)
+{
+    cbq      *q    = client->cbqueue;
+    ioq      *outq = client->outq;
+    cbq_node *node = NULL;
+    char     *cmd_eom;
+    off_t     outq_front;
+    size_t    outq_used, outq_last_len = 0, i;
+    uint64_t  outq_bytes_queued;
+
+    if (count == 0) {
+        struct bsc_put_batch_info info = { user_data, user_cb, { jobs, 0, 0 }, { 0 } };
+        if (user_cb != NULL)
+            user_cb(client, &info);
+        return BSC_ERROR_NONE;
+    }
+
+    if ( !queue_room(client, count, count * 3) )
+        return BSC_ERROR_QUEUE_FULL;
+
+    /* the state to roll back to when a header can not be allocated */
+    cmd_eom           = q->cmd_eom;
+    outq_front        = outq->front;
+    outq_used         = outq->used;
+    outq_bytes_queued = outq->bytes_queued;
+    if ( !AQ_EMPTY(outq) )
+        outq_last_len = AQ_LAST_(outq)->vec->iov_len;
+
+    for (i = 0; i < count; ++i) {
+        node = AQ_FRONT_(q);
+        if ( ( node->data = bsp_gen_put_hdr(cbq_cmd_reserve(q), &(node->len), &(node->is_allocated),
+                jobs[i].priority, jobs[i].delay, jobs[i].ttr, jobs[i].bytes) ) == NULL )
+            goto gen_cmd_error;
+
+        CBQ_CMD_COMMIT(q, node);
+        node->out_start = outq->bytes_queued;
+        outq_enq_cmd(client, node->data, node->len);
+        node->cb             = got_put_batch_res;
+        node->bytes_expected = 0;
+        node->responses_left = 0;
+        node->cb_data->put_batch_info.user_data     = user_data;
+        node->cb_data->put_batch_info.user_cb       = user_cb;
+        node->cb_data->put_batch_info.request.jobs  = jobs;
+        node->cb_data->put_batch_info.request.count = count;
+        node->cb_data->put_batch_info.request.index = i;
+        outq_enq_put_body(client, node);
+        AQ_ENQ_FIN(q);
+    }
+
+    CBQ_ENQ_NOTIFY(client, outq_bytes_queued);
 
     return BSC_ERROR_NONE;
+
+gen_cmd_error:
+    while (i--) {
+        q->front = ( q->front + q->size - 1 ) % q->size;
+        q->used--;
+        if (AQ_FRONT_(q)->is_allocated)
+            free(AQ_FRONT_(q)->data);
+    }
+    q->cmd_eom = AQ_EMPTY(q) ? q->cmd_som = q->cmd_data : cmd_eom;
+
+    outq->front        = outq_front;
+    outq->used         = outq_used;
+    outq->bytes_queued = outq_bytes_queued;
+    if ( !AQ_EMPTY(outq) )
+        ioq_truncate_last(outq, outq_last_len);
+
+    return BSC_ERROR_MEMORY;
+}
+
+/* responses arrive in order, the last job's response completes the batch */
+static void got_put_batch_res(bsc *client, cbq_node *node, const char *data, size_t len)
+{
+    struct bsc_put_batch_info *info = &(node->cb_data->put_batch_info);
+    struct bsc_put_job        *job  = info->request.jobs + info->request.index;
+    size_t i;
+
+    job->response.code = bsp_get_put_res(data, &(job->response.id));
+
+    if ( info->request.index + 1 < info->request.count || info->user_cb == NULL )
+        return;
+
+    for (info->response.inserted = 0, i = 0; i < info->request.count; ++i)
+        if (info->request.jobs[i].response.code == BSC_PUT_RES_INSERTED)
+            ++info->response.inserted;
+
+    info->user_cb(client, info);
 }
 
 static void got_put_res(bsc *client, cbq_node *node, const char *data, size_t len)
 {
     struct bsc_put_info *put_info = &(node->cb_data->put_info);
 
-    client->outq_offset -= 2;
-
     put_info->response.code = bsp_get_put_res(data, &(put_info->response.id));
 
     if (put_info->user_cb != NULL)
@@ -505,10 +1362,12 @@ static void got_use_res(bsc *client, cbq_node *node, const char *data, size_t le
 }
 
 
-bsc_error_t bsc_reserve(bsc                *client,
-                        bsc_reserve_user_cb user_cb,
-                        void               *user_data,
-                        int32_t             timeout)
+static bsc_error_t enq_reserve(bsc                 *client,
+                               bsc_reserve_user_cb  user_cb,
+                               void                *user_data,
+                               int32_t              timeout,
+                               bsc_reserve_alloc_cb alloc,
+                               bsc_reserve_chunk_cb chunk)
 {
     bsc_error_t error;
 
@@ -522,25 +1381,86 @@ bsc_error_t bsc_reserve(bsc                *client,
     }
 
     AQ_FRONT_(client->cbqueue)->cb_data->reserve_info.request.timeout   = timeout;
+    AQ_FRONT_(client->cbqueue)->cb_data->reserve_info.request.alloc     = alloc;
+    AQ_FRONT_(client->cbqueue)->cb_data->reserve_info.request.chunk     = chunk;
+    AQ_FRONT_(client->cbqueue)->cb_data->reserve_info.response.data     = NULL;
+    AQ_FRONT_(client->cbqueue)->cb_data->reserve_info.response.fd       = -1;
     AQ_FRONT_(client->cbqueue)->cb_data->reserve_info.user_data         = user_data;
     AQ_FRONT_(client->cbqueue)->cb_data->reserve_info.user_cb           = user_cb;
     CBQ_ENQ_FIN(client);
     return BSC_ERROR_NONE;
 }
 
+bsc_error_t bsc_reserve(bsc                *client,
+                        bsc_reserve_user_cb user_cb,
+                        void               *user_data,
+                        int32_t             timeout)
+{
+    return enq_reserve(client, user_cb, user_data, timeout, NULL, NULL);
+}
+
+bsc_error_t bsc_reserve_into(bsc                 *client,
+                             bsc_reserve_user_cb  user_cb,
+                             void                *user_data,
+                             int32_t              timeout,
+                             bsc_reserve_alloc_cb alloc)
+{
+    return enq_reserve(client, user_cb, user_data, timeout, alloc, NULL);
+}
+
+bsc_error_t bsc_reserve_stream(bsc                 *client,
+                               bsc_reserve_user_cb  user_cb,
+                               void                *user_data,
+                               int32_t              timeout,
+                               bsc_reserve_chunk_cb chunk_cb)
+{
+    return enq_reserve(client, user_cb, user_data, timeout, NULL, chunk_cb);
+}
+
 static void got_reserve_res(bsc *client, cbq_node *node, const char *data, size_t len)
 {
     struct bsc_reserve_info *reserve_info = &(node->cb_data->reserve_info);
 
+    /* a streamed body was handed to the chunk callback as it arrived, an empty one ends with its CRLF */
+    if (client->body_stream == reserve_info) {
+        if (!reserve_info->response.bytes)
+            reserve_info->request.chunk(client, reserve_info, "", 0, true);
+        return;
+    }
+
     if (node->bytes_expected) {
         reserve_info->response.data = (void *)data;
+        BODY_DISCARDED(reserve_info, data);
         if (reserve_info->user_cb != NULL)
             reserve_info->user_cb(client, reserve_info);
     }
     else {
         reserve_info->response.code = bsp_get_reserve_res(data, &(reserve_info->response.id), &(reserve_info->response.bytes));
-        if (reserve_info->response.code == BSC_RESERVE_RES_RESERVED)
+        if (reserve_info->response.code == BSC_RESERVE_RES_RESERVED) {
             node->bytes_expected = reserve_info->response.bytes;
+            reserve_info->response.fd = -1;
+            /* a streamed body is read past like a discarded one, its chunks going to the chunk callback */
+            if (reserve_info->request.chunk != NULL) {
+                client->body_stream   = reserve_info;
+                client->body_discard  = true;
+                client->body_dst_left = reserve_info->response.bytes;
+                if (reserve_info->user_cb != NULL)
+                    reserve_info->user_cb(client, reserve_info);
+                return;
+            }
+            /* bsc_read places the body in the user's buffer or in a spill file, or discards it over body_max */
+            if ( !reserve_info->response.bytes || reserve_info->response.bytes > client->body_max )
+                return;
+            if ( reserve_info->request.alloc != NULL
+              && ( client->body_dst = reserve_info->request.alloc(client, reserve_info, reserve_info->response.bytes) ) != NULL ) {
+                reserve_info->response.data = client->body_dst;
+                client->body_dst_pos  = (char *)client->body_dst;
+                client->body_dst_left = reserve_info->response.bytes;
+            }
+            else if ( client->spill_threshold && reserve_info->response.bytes >= client->spill_threshold
+                   && spill_body(client, reserve_info->response.bytes) )
+                reserve_info->response.fd = client->spill_fd;
+        }
         else {
             if (reserve_info->user_cb != NULL)
                 reserve_info->user_cb(client, reserve_info);
@@ -548,6 +1468,68 @@ static void got_reserve_res(bsc *client, cbq_node *node, const char *data, size_
     }
 }
 
+void *bsc_job_take(bsc *client)
+{
+    /* the spare gets the rest of the input and vec_min to read on, not another buffer the size of the body */
+    return client->body_in_cb ? ivector_take(client->vec, client->body_tail + client->vec_min + 1) : NULL;
+}
+
+void bsc_set_spill(bsc *client, size_t threshold)
+{
+    client->spill_threshold = threshold;
+}
+
+/* the body is received into a shared mapping of an anonymous file the size of the body */
+static bool spill_body(bsc *client, size_t bytes)
+{
+    void *map = NULL;
+    int   fd;
+#ifdef HAVE_MEMFD_CREATE
+    if ( ( fd = memfd_create("bsc-job", MFD_CLOEXEC) ) == -1 )
+        return false;
+#else
+    char  path[] = "/tmp/bsc-job-XXXXXX";
+
+    if ( ( fd = mkstemp(path) ) == -1 )
+        return false;
+    unlink(path);
+#endif
+
+    if ( ftruncate(fd, bytes) == -1
+      || ( map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) ) == MAP_FAILED ) {
+        close(fd);
+        return false;
+    }
+
+    client->body_dst      = map;
+    client->body_dst_pos  = (char *)map;
+    client->body_dst_left = client->spill_len = bytes;
+    client->spill_fd      = fd;
+
+    return true;
+}
+
+/* the body is done once none of it is left */
+static void body_stream_chunk(bsc *client, const char *chunk, size_t len)
+{
+    if (len)
+        client->body_stream->request.chunk(client, client->body_stream, chunk, len, client->body_dst_left == 0);
+}
+
+/* drops the destination of a placed body, a spill file is unmapped and closed */
+static void body_dst_reset(bsc *client)
+{
+    if (client->spill_fd != -1) {
+        munmap(client->body_dst, client->spill_len);
+        close(client->spill_fd);
+        client->spill_fd = -1;
+    }
+    client->body_dst      = NULL;
+    client->body_dst_left = 0;
+    client->body_discard  = false;
+    client->body_stream   = NULL;
+}
+
 bsc_error_t bsc_delete(bsc                *client,
                        bsc_delete_user_cb  user_cb,
                        void               *user_data,
@@ -622,6 +1604,138 @@ bsc_error_t bsc_touch(bsc                *client,
     return BSC_ERROR_NONE;
 }
 
+/* the commands and the response codes share one allocation that is freed with the queue node */
+static bsc_error_t enq_ids(bsc            *client,
+                           bsc_ids_user_cb user_cb,
+                           void           *user_data,
+                           enum ids_cmd_e  cmd,
+                           const uint64_t *ids,
+                           size_t          count,
+                           uint32_t        priority,
+                           uint32_t        delay)
+{
+    static const size_t cmd_max_len = CONST_STRLEN("release   \r\n") + 20 + 10 + 10;
+    cbq_node *node = NULL;
+    char     *data = NULL, *p = NULL;
+    int       len;
+    bool      is_allocated;
+    size_t    codes_offset, i;
+
+    if (count == 0) {
+        struct bsc_ids_info info = { user_data, user_cb, { cmd, ids, 0, priority, delay }, { NULL, 0, 0 } };
+        if (user_cb != NULL)
+            user_cb(client, &info);
+        return BSC_ERROR_NONE;
+    }
+
+    if ( !queue_room(client, 1, 1) )
+        return BSC_ERROR_QUEUE_FULL;
+
+    codes_offset = ( cmd_max_len * count + sizeof(bsc_response_t) - 1 ) / sizeof(bsc_response_t) * sizeof(bsc_response_t);
+    if ( ( data = (char *)malloc(codes_offset + sizeof(bsc_response_t) * count) ) == NULL )
+        return BSC_ERROR_MEMORY;
+
+    for (p = data, i = 0; i < count; ++i, p += len)
+        switch (cmd) {
+            case BSC_IDS_T_DELETE:
+                bsp_gen_delete_cmd(p, &len, &is_allocated, ids[i]);
+                break;
+            case BSC_IDS_T_TOUCH:
+                bsp_gen_touch_cmd(p, &len, &is_allocated, ids[i]);
+                break;
+            case BSC_IDS_T_RELEASE:
+                bsp_gen_release_cmd(p, &len, &is_allocated, ids[i], priority, delay);
+                break;
+            case BSC_IDS_T_BURY:
+                bsp_gen_bury_cmd(p, &len, &is_allocated, ids[i], priority);
+                break;
+        }
+
+    node = AQ_FRONT_(client->cbqueue);
+    node->data           = data;
+    node->len            = p - data;
+    node->is_allocated   = true;
+    node->cb             = got_ids_res;
+    node->bytes_expected = 0;
+    node->responses_left = count - 1;
+    node->cb_data->ids_info.user_data          = user_data;
+    node->cb_data->ids_info.user_cb            = user_cb;
+    node->cb_data->ids_info.request.cmd        = cmd;
+    node->cb_data->ids_info.request.ids        = ids;
+    node->cb_data->ids_info.request.count      = count;
+    node->cb_data->ids_info.request.priority   = priority;
+    node->cb_data->ids_info.request.delay      = delay;
+    node->cb_data->ids_info.response.codes     = (bsc_response_t *)(data + codes_offset);
+    node->cb_data->ids_info.response.count     = 0;
+    node->cb_data->ids_info.response.succeeded = 0;
+    node->out_start = client->outq->bytes_queued;
+    outq_enq_cmd(client, node->data, node->len);
+    node->out_end   = client->outq->bytes_queued;
+    CBQ_ENQ_FIN(client);
+
+    return BSC_ERROR_NONE;
+}
+
+bsc_error_t bsc_delete_many(bsc             *client,
+                            bsc_ids_user_cb  user_cb,
+                            void            *user_data,
+                            const uint64_t  *ids,
+                            size_t           count)
+{
+    return enq_ids(client, user_cb, user_data, BSC_IDS_T_DELETE, ids, count, 0, 0);
+}
+
+bsc_error_t bsc_touch_many(bsc             *client,
+                           bsc_ids_user_cb  user_cb,
+                           void            *user_data,
+                           const uint64_t  *ids,
+                           size_t           count)
+{
+    return enq_ids(client, user_cb, user_data, BSC_IDS_T_TOUCH, ids, count, 0, 0);
+}
+
+bsc_error_t bsc_release_many(bsc             *client,
+                             bsc_ids_user_cb  user_cb,
+                             void            *user_data,
+                             const uint64_t  *ids,
+                             size_t           count,
+                             uint32_t         priority,
+                             uint32_t         delay)
+{
+    return enq_ids(client, user_cb, user_data, BSC_IDS_T_RELEASE, ids, count, priority, delay);
+}
+
+bsc_error_t bsc_bury_many(bsc             *client,
+                          bsc_ids_user_cb  user_cb,
+                          void            *user_data,
+                          const uint64_t  *ids,
+                          size_t           count,
+                          uint32_t         priority)
+{
+    return enq_ids(client, user_cb, user_data, BSC_IDS_T_BURY, ids, count, priority, 0);
+}
+
+/* the node stays at the head of the queue until every id was answered */
+static void got_ids_res(bsc *client, cbq_node *node, const char *data, size_t len)
+{
+    static bsc_response_t (* const get_res[])(const char *) = {
+        bsp_get_delete_res, bsp_get_touch_res, bsp_get_release_res, bsp_get_bury_res
+    };
+    static const bsc_response_t succeeded[] = {
+        BSC_DELETE_RES_DELETED, BSC_TOUCH_RES_TOUCHED, BSC_RELEASE_RES_RELEASED, BSC_RES_BURIED
+    };
+    struct bsc_ids_info *info = &(node->cb_data->ids_info);
+    bsc_response_t code = get_res[info->request.cmd](data);
+
+    info->response.codes[info->response.count++] = code;
+    if (code == succeeded[info->request.cmd])
+        ++info->response.succeeded;
+
+    node->responses_left = info->request.count - info->response.count;
+    if (node->responses_left == 0 && info->user_cb != NULL)
+        info->user_cb(client, info);
+}
+
 bsc_error_t bsc_watch(bsc                *client,
                       bsc_watch_user_cb   user_cb,
                       void               *user_data,
@@ -767,6 +1881,7 @@ static void got_peek_res(bsc *client, cbq_node *node, const char *data, size_t l
 
     if (node->bytes_expected) {
         peek_info->response.data = (void *)data;
+        BODY_DISCARDED(peek_info, data);
         if (peek_info->user_cb != NULL)
             peek_info->user_cb(client, peek_info);
     }
@@ -853,7 +1968,7 @@ static void got_stats_job_res(bsc *client, cbq_node *node, const char *data, siz
 
     if (node->bytes_expected) {
         stats_job_info->response.data  = (void *)data;
-        stats_job_info->response.stats = bsp_parse_job_stats(data);
+        stats_job_info->response.stats = BODY_DISCARDED(stats_job_info, data) ? NULL : bsp_parse_job_stats(data);
         if (stats_job_info->user_cb != NULL)
             stats_job_info->user_cb(client, stats_job_info);
     }
@@ -892,7 +2007,7 @@ static void got_stats_tube_res(bsc *client, cbq_node *node, const char *data, si
 
     if (node->bytes_expected) {
         stats_tube_info->response.data  = (void *)data;
-        stats_tube_info->response.stats = bsp_parse_tube_stats(data);
+        stats_tube_info->response.stats = BODY_DISCARDED(stats_tube_info, data) ? NULL : bsp_parse_tube_stats(data);
         if (stats_tube_info->user_cb != NULL)
             stats_tube_info->user_cb(client, stats_tube_info);
     }
@@ -929,7 +2044,7 @@ static void got_server_stats_res(bsc *client, cbq_node *node, const char *data,
 
     if (node->bytes_expected) {
         server_stats_info->response.data  = (void *)data;
-        server_stats_info->response.stats = bsp_parse_server_stats(data);
+        server_stats_info->response.stats = BODY_DISCARDED(server_stats_info, data) ? NULL : bsp_parse_server_stats(data);
         if (server_stats_info->user_cb != NULL)
             server_stats_info->user_cb(client, server_stats_info);
     }
@@ -966,7 +2081,7 @@ static void got_list_tubes_res(bsc *client, cbq_node *node, const char *data, si
 
     if (node->bytes_expected) {
         list_tubes_info->response.data  = (void *)data;
-        list_tubes_info->response.tubes = bsp_parse_tube_list(data);
+        list_tubes_info->response.tubes = BODY_DISCARDED(list_tubes_info, data) ? NULL : bsp_parse_tube_list(data);
         if (list_tubes_info->user_cb != NULL)
             list_tubes_info->user_cb(client, list_tubes_info);
     }
@@ -1009,20 +2124,183 @@ static bool insert_tube_after(const char *name, struct bsc_tube_list *l)
     }
 }
 
-static void outq_shift(ioq *q, ptrdiff_t s)
+/* makes room for cmds commands that take up to nodes output nodes, the queues double up to buf_max commands */
+static bool queue_room(bsc *client, size_t cmds, size_t nodes)
+{
+    cbq   *q    = client->cbqueue;
+    ioq   *outq = client->outq;
+    size_t size;
+
+    if ( AQ_NODES_FREE(q) < cmds ) {
+        if (q->used + cmds > client->buf_max)
+            return false;
+        for (size = q->size * 2; size - q->used < cmds; size *= 2) ;
+        if ( !cbq_resize(q, size < client->buf_max ? size : client->buf_max) )
+            return false;
+    }
+
+    if ( AQ_NODES_FREE(outq) < nodes ) {
+        if (outq->used + nodes > client->buf_max * 3)
+            return false;
+        for (size = outq->size * 2; size - outq->used < nodes; size *= 2) ;
+        if ( !ioq_resize(outq, size < client->buf_max * 3 ? size : client->buf_max * 3) )
+            return false;
+    }
+
+    return true;
+}
+
+/* 
+ * the offset of the next line feed at or after from in a chunk of len bytes, -1 if there is none.
+ * cur points to the byte at from, the chunk is indexed a batch at a time as the responses are framed.
+ */
+static ssize_t next_lf(struct lf_index *idx, const char *cur, size_t from, size_t len)
+{
+    size_t start, scanned;
+
+    for (;;) {
+        while ( idx->next < idx->count && idx->base + idx->pos[idx->next] < from )
+            ++idx->next;
+        if (idx->next < idx->count)
+            return idx->base + idx->pos[idx->next];
+
+        if ( ( start = idx->scanned > from ? idx->scanned : from ) >= len )
+            return -1;
+        idx->count   = bsp_scan_lf(cur + ( start - from ), len - start, idx->pos, BSP_LF_BATCH, &scanned);
+        idx->base    = start;
+        idx->scanned = start + scanned;
+        idx->next    = 0;
+    }
+}
+
+/* tells producers to resume at the low watermark and shrinks the idle queues back to buf_len (and the input buffer with idle_trim) */
+static void queue_check(bsc *client)
+{
+    if ( client->above_high && client->cbqueue->used <= client->buf_low ) {
+        client->above_high = false;
+        if (client->watermark_cb != NULL)
+            client->watermark_cb(client, false);
+    }
+
+    if ( AQ_EMPTY(client->cbqueue) && client->cbqueue->size > client->buf_len )
+        cbq_resize(client->cbqueue, client->buf_len);
+
+    if ( AQ_EMPTY(client->outq) && client->outq->size > client->buf_len * 3 )
+        ioq_resize(client->outq, client->buf_len * 3);
+
+    if ( client->idle_trim && client->vec->size > client->vec_len )
+        bsc_trim(client);
+}
+
+/* arena commands are appended to the previous node whenever they directly follow it */
+static void outq_enq_cmd(bsc *client, char *data, size_t len)
+{
+    if ( CBQ_CMD_OWNS(client->cbqueue, data) && data != client->cbqueue->cmd_data )
+        ioq_enq_append_(client->outq, data, len);
+    else
+        ioq_enq_(client->outq, data, len, false);
+}
+
+/* the CRLF that ends a put body is stored right after the header so the next command can follow it */
+static char *outq_enq_put_body(bsc *client, cbq_node *node)
+{
+    struct bsc_put_info *put_info = &(node->cb_data->put_info);
+    struct bsc_put_job  *job      = NULL;
+    char *crlf = (char *)CRLF;
+
+    if ( CBQ_CMD_OWNS(client->cbqueue, node->data) ) {
+        crlf = (char *)node->data + node->len;
+        memcpy(crlf, CRLF, CONST_STRLEN(CRLF));
+        if (client->cbqueue->cmd_eom == crlf)
+            client->cbqueue->cmd_eom += CONST_STRLEN(CRLF);
+    }
+
+    if (node->cb == got_put_batch_res) {
+        job = node->cb_data->put_batch_info.request.jobs + node->cb_data->put_batch_info.request.index;
+        ioq_enq_(client->outq, (char *)job->data, job->bytes, false);
+    }
+    else if (put_info->request.fd >= 0)
+        ioq_enq_fd_(client->outq, put_info->request.fd, put_info->request.offset, put_info->request.bytes,
+            put_info->request.release, put_info->request.release_ctx);
+    else
+        ioq_enq_release_(client->outq, (char *)put_info->request.data, put_info->request.bytes,
+            put_info->request.release, put_info->request.release_ctx);
+    outq_enq_cmd(client, crlf, CONST_STRLEN(CRLF));
+    node->out_end = client->outq->bytes_queued;
+
+    return crlf;
+}
+
+/* 
+ * rebuilds the outgoing queue from the commands that are still waiting for a response.
+ * puts whose data was already released can not be resent, they are removed from the
+ * queue and a copy of their info is returned in dropped (to be completed by the caller).
+ */
+static bool outq_replay(bsc *client, struct bsc_put_info **dropped, size_t *dropped_count)
 {
-    q->rear += s;
-    q->used -= s;
+    cbq      *q = client->cbqueue;
+    cbq_node *node = NULL, tmp;
+    char     *data = NULL;
+    size_t    i, j, kept = 0;
+
+    *dropped       = NULL;
+    *dropped_count = 0;
+
+    for (i = 0; i < q->used; ++i)
+        if ( PUT_RELEASED(client, AQ_NTH_(q, i)) )
+            ++*dropped_count;
+
+    if ( *dropped_count
+      && ( *dropped = (struct bsc_put_info *)malloc(sizeof(struct bsc_put_info) * *dropped_count) ) == NULL )
+        return false;
 
-    if (q->rear < 0)
-        q->rear += q->size;
-    else if (q->rear > q->size)
-        q->rear %= q->size;
+    *dropped_count = 0;
+    for (i = 0; i < q->used; ++i) {
+        node = AQ_NTH_(q, i);
+        if ( PUT_RELEASED(client, node) ) {
+            (*dropped)[(*dropped_count)++] = node->cb_data->put_info;
+            if (node->is_allocated)
+                free(node->data);
+            continue;
+        }
+        if (kept != i) {
+            tmp = *AQ_NTH_(q, kept);
+            *AQ_NTH_(q, kept) = *node;
+            *node = tmp;
+        }
+        ++kept;
+    }
+    q->used  = kept;
+    q->front = (q->rear + kept) % q->size;
+    if (AQ_EMPTY(q))
+        q->cmd_som = q->cmd_eom = q->cmd_data;
+
+    ioq_clear(client->outq);
+
+    for (i = 0; i < q->used; ++i) {
+        node = AQ_NTH_(q, i);
+        if ( AQ_NODES_FREE(client->outq) < 3 && !ioq_resize(client->outq, client->outq->size * 2) )
+            return false;
+        node->bytes_expected = 0;
+        data = node->data;
+        /* the ids that were answered are not sent again */
+        if (node->cb == got_ids_res)
+            for (j = node->cb_data->ids_info.response.count; j > 0; --j)
+                data = (char *)memchr(data, '\n', node->len - (data - (char *)node->data)) + 1;
+        node->out_start = client->outq->bytes_queued;
+        outq_enq_cmd(client, data, node->len - (data - (char *)node->data));
+        node->out_end   = client->outq->bytes_queued;
+        if (node->cb == got_put_res || node->cb == got_put_batch_res)
+            outq_enq_put_body(client, node);
+    }
+
+    return true;
 }
 
 void debug_show_queue(bsc *client)
 {
-    int i, debug_str_pos = 0;
+    size_t i;
+    int debug_str_pos = 0;
     char debug_str[9000];
     ioq_node *curr_node = NULL;
 
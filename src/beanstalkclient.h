@@ -55,6 +55,8 @@ struct _cbq;
  *-----------------------------------------------------------------------------*/
 
 enum _bsc_response_e_t {
+    BSC_RES_CLIENT_TOO_LARGE = -4,     // the body is over the client's input limits and was discarded
+    BSC_RES_CLIENT_DISCONNECTED = -3,  // the connection was lost after the command could no longer be resent
     BSC_RES_CLIENT_OUT_OF_MEMORY = -2, // client is out of memory
     BSC_RES_UNRECOGNIZED = -1,         // parse error
 
@@ -242,12 +244,14 @@ void bsc_server_stats_free(bsc_server_stats *server);
 
 struct _bsc;
 struct bsc_put_info;
+struct bsc_put_batch_info;
 struct bsc_use_info;
 struct bsc_reserve_info;
 struct bsc_delete_info;
 struct bsc_release_info;
 struct bsc_bury_info;
 struct bsc_touch_info;
+struct bsc_ids_info;
 struct bsc_watch_info;
 struct bsc_ignore_info;
 struct bsc_peek_info;
@@ -259,6 +263,7 @@ struct bsc_server_stats_info;
 struct bsc_list_tubes_info;
 
 typedef void (*bsc_put_user_cb)(struct _bsc *, struct bsc_put_info *);
+typedef ioq_release_cb bsc_release_cb;
 
 struct bsc_put_info {
     void *user_data;
@@ -269,7 +274,11 @@ struct bsc_put_info {
         uint32_t    ttr;
         size_t      bytes;
         const char *data;
+        int         fd;
+        off_t       offset;
         bool        autofree;
+        bsc_release_cb release;
+        void       *release_ctx;
     } request;
     struct {
         bsc_response_t code;
@@ -277,6 +286,34 @@ struct bsc_put_info {
     } response;
 };
 
+typedef void (*bsc_put_batch_user_cb)(struct _bsc *, struct bsc_put_batch_info *);
+
+/* a job of bsc_put_batch, response is filled in as the server answers */
+struct bsc_put_job {
+    uint32_t    priority;
+    uint32_t    delay;
+    uint32_t    ttr;
+    size_t      bytes;
+    const char *data;
+    struct {
+        bsc_response_t code;
+        uint64_t       id;
+    } response;
+};
+
+struct bsc_put_batch_info {
+    void *user_data;
+    bsc_put_batch_user_cb user_cb;
+    struct {
+        struct bsc_put_job *jobs;
+        size_t              count;
+        size_t              index;      // the job a queued command waits for
+    } request;
+    struct {
+        size_t inserted;                // the number of jobs with BSC_PUT_RES_INSERTED
+    } response;
+};
+
 typedef void (*bsc_use_user_cb)(struct _bsc *, struct bsc_use_info *);
 
 struct bsc_use_info {
@@ -292,18 +329,23 @@ struct bsc_use_info {
 };
 
 typedef void (*bsc_reserve_user_cb)(struct _bsc *, struct bsc_reserve_info *);
+typedef void *(*bsc_reserve_alloc_cb)(struct _bsc *, struct bsc_reserve_info *, size_t bytes);
+typedef void  (*bsc_reserve_chunk_cb)(struct _bsc *, struct bsc_reserve_info *, const char *chunk, size_t len, bool last);
 
 struct bsc_reserve_info {
     void *user_data;
     bsc_reserve_user_cb user_cb;
     struct {
         int32_t timeout;
+        bsc_reserve_alloc_cb alloc;
+        bsc_reserve_chunk_cb chunk;
     } request;
     struct {
         bsc_response_t code;
         uint64_t       id;
         size_t         bytes;
         void          *data;
+        int            fd;      /* the file data maps when the body was spilled, -1 otherwise */
     } response;
 };
 
@@ -362,6 +404,29 @@ struct bsc_touch_info {
     } response;
 };
 
+enum ids_cmd_e {
+    BSC_IDS_T_DELETE, BSC_IDS_T_TOUCH, BSC_IDS_T_RELEASE, BSC_IDS_T_BURY
+};
+
+typedef void (*bsc_ids_user_cb)(struct _bsc *, struct bsc_ids_info *);
+
+struct bsc_ids_info {
+    void *user_data;
+    bsc_ids_user_cb user_cb;
+    struct {
+        enum ids_cmd_e  cmd;
+        const uint64_t *ids;
+        size_t          count;
+        uint32_t        priority;   // release and bury
+        uint32_t        delay;      // release
+    } request;
+    struct {
+        bsc_response_t *codes;      // the response to each id, valid during the callback
+        size_t          count;      // the number of responses so far
+        size_t          succeeded;  // the number of DELETED/TOUCHED/RELEASED/BURIED responses
+    } response;
+};
+
 typedef void (*bsc_watch_user_cb)(struct _bsc *, struct bsc_watch_info *);
 
 struct bsc_watch_info {
@@ -499,12 +564,14 @@ struct bsc_list_tubes_info {
 
 union bsc_cmd_info {
     struct bsc_put_info             put_info;
+    struct bsc_put_batch_info       put_batch_info;
     struct bsc_use_info             use_info;
     struct bsc_reserve_info         reserve_info;
     struct bsc_delete_info          delete_info;
     struct bsc_release_info         release_info;
     struct bsc_bury_info            bury_info;
     struct bsc_touch_info           touch_info;
+    struct bsc_ids_info             ids_info;
     struct bsc_watch_info           watch_info;
     struct bsc_ignore_info          ignore_info;
     struct bsc_peek_info            peek_info;
@@ -516,7 +583,13 @@ union bsc_cmd_info {
     struct bsc_list_tubes_info      list_tubes_info;
 };
 
-#define BSC_BUFFER_NODES_FREE(c) (AQ_NODES_FREE((c)->outq) - (c)->outq_offset)
+#define BSC_BUFFER_NODES_FREE(c) AQ_NODES_FREE((c)->outq)
+
+/* bsc_read stopped at its budget (or ran out of memory) before the socket was drained */
+#define BSC_READ_MORE(c) ((c)->read_more)
+
+/* the number of zerocopy sends the kernel reported done (see bsc_set_zerocopy) */
+#define BSC_ZEROCOPY_COMPLETED(c) ((c)->outq->zc_completed)
 
 #define BSC_DEFAULT_BUFFER_SIZE   1024
 #define BSC_DEFAULT_VECTOR_SIZE   1024
@@ -536,16 +609,21 @@ union bsc_cmd_info {
         BSC_DEFAULT_VECTOR_MIN,                                  \
         (errorstr) ) )
 
-enum _bsc_error_e_t { BSC_ERROR_NONE, BSC_ERROR_INTERNAL, BSC_ERROR_SOCKET, BSC_ERROR_MEMORY, BSC_ERROR_QUEUE_FULL };
+enum _bsc_error_e_t { BSC_ERROR_NONE, BSC_ERROR_INTERNAL, BSC_ERROR_SOCKET, BSC_ERROR_MEMORY, BSC_ERROR_QUEUE_FULL,
+                      BSC_ERROR_INPUT_LIMIT, BSC_ERROR_BAD_FD };
 
 typedef enum _bsc_error_e_t bsc_error_t;
 
 typedef void (*error_callback_p_t)(struct _bsc *, bsc_error_t);
 typedef int  (*bsc_buffer_fill_cb)(struct _bsc *);
 typedef void (*bsc_conn_cb)(struct _bsc *);
+typedef void (*bsc_watermark_cb)(struct _bsc *, bool above);
+typedef void (*bsc_flush_timer_cb)(struct _bsc *, unsigned long usec);
 
 typedef enum { BSC_STATE_DISCONNECTED, BSC_STATE_CONNECTED } bsc_state_t;
 
+typedef struct _bsc_uring bsc_uring;
+
 struct bsc_tube_list {
     char   *name;
     struct bsc_tube_list *next;
@@ -561,15 +639,53 @@ struct _bsc {
     ioq     *outq;
     ioq     *tubeq;
     struct _ivector *vec;
+    size_t   vec_len;
     size_t   vec_min;
+    size_t   vec_max;
+    size_t   body_max;
+    size_t   buf_len;
+    size_t   buf_max;
+    size_t   buf_high;
+    size_t   buf_low;
+    bool     above_high;
+    size_t   zerocopy_threshold;
+    int      busy_poll_usec;
     void    *data;
-    size_t   outq_offset;
     struct bsc_tube_list *watched_tubes;
     bsc_state_t state;
+    bool     corked;
+    bool     eager_write;
+    size_t   flush_bytes;
+    size_t   flush_cmds;
+    unsigned long flush_usec;
+    bool     flush_timer_armed;
+    bool     read_drain;
+    bool     read_more;
+    size_t   read_max_bytes;
+    size_t   read_max_responses;
+    void    *body_dst;
+    char    *body_dst_pos;
+    size_t   body_dst_left;
+    bool     body_discard;
+    bool     body_in_cb;            /* a body from the input buffer is being passed to its callback */
+    size_t   body_tail;             /* the bytes received after it, moved on when the buffer is taken */
+    struct bsc_reserve_info *body_stream;
+    bool     idle_trim;
+    size_t   spill_threshold;
+    int      spill_fd;
+    size_t   spill_len;
+    bsc_uring *uring;
+    struct _bsc *uring_next;
+    unsigned uring_ops;             /* io_uring requests in flight */
+    unsigned uring_stale;           /* ones on a socket that was disconnected since */
+    struct iovec uring_iov[2];
+    struct iovec *uring_wiov;       /* a copy of the iovecs being written */
     unsigned watched_tubes_count;
     bsc_buffer_fill_cb buffer_fill_cb;
     bsc_conn_cb pre_disconnect_cb;
     bsc_conn_cb post_connect_cb;
+    bsc_watermark_cb watermark_cb;
+    bsc_flush_timer_cb flush_timer_cb;
     error_callback_p_t onerror;
 };
 
@@ -582,7 +698,7 @@ typedef struct _bsc bsc;
 * @param port           the beanstalkd port
 * @param default_tube   the tube to use and watch
 * @param onerror        callback on error
-* @param buf_len        the write queue size (messages not bytes) it does not grow
+* @param buf_len        the initial write queue size (messages not bytes), see bsc_set_buffer_limits
 * @param vec_len        the input buffer initial size (doubles automatically)
 * @param vec_min        the input buffer minimum size - if reached size will double
 * @param errorstr       a string to store an error in (must be at least BSC_ERRSTR_LEN)
@@ -593,6 +709,53 @@ bsc *bsc_new(const char *host, const char *port, const char *default_tube,
              error_callback_p_t onerror, size_t buf_len,
              size_t vec_len, size_t vec_min, char *errorstr);
 
+/** 
+* lets the write queue grow up to max_len commands (doubling when full) instead of failing with
+* BSC_ERROR_QUEUE_FULL, it shrinks back to buf_len whenever it is empty.
+* watermark_cb is called with true once high commands are pending and with false
+* once they dropped to low, producers should pause in between.
+* 
+* @param client        a bsc instance
+* @param max_len       the maximal write queue size (messages not bytes), at least buf_len
+* @param high          the number of pending commands to pause at
+* @param low           the number of pending commands to resume at (lower than high)
+* @param watermark_cb  the pause/resume callback (may be NULL)
+*/
+void bsc_set_buffer_limits(bsc *client, size_t max_len, size_t high, size_t low, bsc_watermark_cb watermark_cb);
+
+/** 
+* bounds the memory the input path takes. bodies over body_max bytes, or that would not fit in an
+* input buffer of vec_max bytes, are read past and discarded without being buffered (not placed
+* by bsc_reserve_into or spilled either), their callback gets BSC_RES_CLIENT_TOO_LARGE along with the
+* header fields (the job id, so the job can be buried). a response line that does not fit in vec_max
+* bytes fails the client with BSC_ERROR_INPUT_LIMIT.
+* 
+* @param client    a bsc instance
+* @param vec_max   the largest the input buffer may grow to (0 for no limit, at least its current size)
+* @param body_max  the largest body to accept (0 for no limit)
+*/
+void bsc_set_input_limits(bsc *client, size_t vec_max, size_t body_max);
+
+/** 
+* gives back the memory an idle client kept from its last burst: the input buffer goes back to
+* vec_len bytes and the queues to buf_len commands. the client is idle once no command is in flight
+* and no response is pending. not to be called from a response callback.
+* 
+* @param client  a bsc instance
+* 
+* @return        false when the client is not idle (nothing was trimmed) or out of memory
+*/
+bool bsc_trim(bsc *client);
+
+/** 
+* trims the client (see bsc_trim) every time it becomes idle. the rings are always trimmed,
+* this adds the input buffer, which is then reallocated after every burst that grew it.
+* 
+* @param client     a bsc instance
+* @param idle_trim  true to trim whenever the client becomes idle
+*/
+void bsc_set_idle_trim(bsc *client, bool idle_trim);
+
 /** 
 * frees all resources taken by the client
 *
@@ -634,6 +797,16 @@ bool bsc_reconnect(bsc *client, char *errorstr);
 */
 void bsc_write(bsc *client);
 
+/** 
+* counts the commands that were completely written and wait for their response.
+* commands are written in order so they are found with a binary search over their output ranges.
+* 
+* @param client   a bsc instance
+* 
+* @return         the number of commands in flight
+*/
+size_t bsc_cmds_in_flight(bsc *client);
+
 /** 
 * call this funcion when the client's fd is ready for reading.
 * 
@@ -641,6 +814,149 @@ void bsc_write(bsc *client);
 */
 void bsc_read(bsc *client);
 
+/** 
+* sets SO_BUSY_POLL on the client's socket (now and on every connect), the kernel then polls the device
+* queue instead of waiting for an interrupt when the socket is read and has no data, which is what
+* bsc_poll_spin does. it takes a dedicated core to pay off.
+* 
+* @param client   a bsc instance
+* @param usec     the busy poll time in microseconds, 0 to turn it off
+* 
+* @return         false when the option could not be set (unsupported, or above net.core.busy_read
+*                 without CAP_NET_ADMIN)
+*/
+bool bsc_set_busy_poll(bsc *client, int usec);
+
+/** 
+* writes the pending commands and spins on nonblocking reads for up to budget_us microseconds,
+* returning as soon as the responses that arrived were dispatched. meant for latency critical
+* consumers, e.g. right after a reserve, before yielding to the event loop.
+* 
+* @param client     a bsc instance
+* @param budget_us  the longest to spin in microseconds
+* 
+* @return           the number of responses dispatched, 0 when the budget ran out or on error
+*/
+size_t bsc_poll_spin(bsc *client, unsigned long budget_us);
+
+/** 
+* creates an io_uring engine for hosts driving many clients, the socket io of all the attached clients
+* goes through a single io_uring_enter per bsc_uring_run instead of a recv/writev per client and event.
+* 
+* @param entries   the submission queue size, two per attached client submit them all at once
+* @param errorstr  a string to store an error in (must be at least BSC_ERRSTR_LEN)
+* 
+* @return          the engine, NULL when out of memory or when io_uring is not available
+*/
+bsc_uring *bsc_uring_new(unsigned entries, char *errorstr);
+
+/** 
+* detaches the clients that are still attached and frees the engine.
+* 
+* @param ring  the engine
+*/
+void bsc_uring_free(bsc_uring *ring);
+
+/** 
+* hands the client's socket io over to the engine, bsc_uring_run writes its commands and reads its responses
+* from now on and the host no longer polls its socket (bsc_read and bsc_write do nothing while a request of
+* the engine is in flight). the socket is only read while a response is expected. files, zerocopy nodes
+* and the tube commands restored on connect are still written by bsc_write (called from bsc_uring_run).
+* 
+* @param ring    the engine
+* @param client  a bsc instance
+* 
+* @return        false when out of memory or the client is attached to another engine
+*/
+bool bsc_uring_attach(bsc_uring *ring, bsc *client);
+
+/** 
+* waits for the client's requests in flight (a pending read is cancelled) and hands its socket back
+* to the host. bsc_free detaches the client.
+* 
+* @param client  a bsc instance
+*/
+void bsc_uring_detach(bsc *client);
+
+/** 
+* submits a write for every attached client with pending commands and a read for every one waiting for
+* responses, then dispatches the completions (the response callbacks run from here). meant to be called
+* once per loop iteration.
+* 
+* the wait ends at the next completion or after timeout_ms, whichever comes first, so a host timer
+* (e.g. for bsc_flush_timeout) must check its own deadline rather than count on a full timed wait.
+* 
+* @param ring        the engine
+* @param timeout_ms  the longest to wait for a completion, -1 to wait for one, 0 not to wait
+* 
+* @return            the number of reads and writes completed, -1 on error (errno is set)
+*/
+int bsc_uring_run(bsc_uring *ring, int timeout_ms);
+
+/** 
+* makes bsc_read call recv and dispatch the responses until the socket has no more data (EAGAIN),
+* as edge triggered loops require. the budget is checked after each recv, once it is used up
+* bsc_read returns with BSC_READ_MORE set and the host should call it again soon.
+* 
+* @param client         a bsc instance
+* @param drain          true to read until EAGAIN, false for a single recv per call
+* @param max_bytes      the bytes to receive per call (0 for no limit)
+* @param max_responses  the responses to dispatch per call (0 for no limit)
+*/
+void bsc_set_read_drain(bsc *client, bool drain, size_t max_bytes, size_t max_responses);
+
+/** 
+* writes a command as soon as it is enqueued when nothing else is waiting to be written,
+* saving a round of the event loop. only what the socket did not take waits for buffer_fill_cb
+* and bsc_write, which also reports socket errors. release callbacks may be called from within
+* the put call, a put they make themselves is written once the released data was retired.
+* 
+* @param client       a bsc instance
+* @param eager_write  true to write on enqueue
+*/
+void bsc_set_eager_write(bsc *client, bool eager_write);
+
+/** 
+* holds back the commands enqueued from now on, bsc_write does not send anything
+* and buffer_fill_cb is not called until the client is uncorked.
+* 
+* @param client   a bsc instance
+*/
+void bsc_cork(bsc *client);
+
+/** 
+* sends everything that was queued while corked with TCP_CORK set, so a batch of commands
+* goes out in as few segments as possible. buffer_fill_cb is called when some of it is left
+* for the next bsc_write.
+* 
+* @param client   a bsc instance
+*/
+void bsc_uncork(bsc *client);
+
+/** 
+* holds back enqueued commands (neither buffer_fill_cb nor an eager write is triggered) until
+* bytes bytes or cmds commands wait to be written, so they go out in larger writes.
+* flush_timer_cb is called with usec when the first command is held back, the host should
+* call bsc_flush_timeout once that many microseconds have passed, which bounds the delay.
+* a timer is never cancelled, a held back batch may just go out sooner.
+* 
+* @param client          a bsc instance
+* @param bytes           the number of unwritten bytes to flush at (0 for no limit)
+* @param cmds            the number of unwritten commands to flush at (0 for no limit)
+* @param usec            the longest a command is held back
+* @param flush_timer_cb  arms a one shot timer in the host loop, NULL turns the policy off
+*/
+void bsc_set_flush_policy(bsc *client, size_t bytes, size_t cmds, unsigned long usec,
+                          bsc_flush_timer_cb flush_timer_cb);
+
+/** 
+* call this function when the timer armed by flush_timer_cb fires.
+* writes the commands that were held back, buffer_fill_cb is called when some of them are left.
+* 
+* @param client   a bsc instance
+*/
+void bsc_flush_timeout(bsc *client);
+
 /** 
 * puts a job into the beanstalk server.
 * 
@@ -666,6 +982,105 @@ bsc_error_t bsc_put(bsc            *client,
                     const char     *data,
                     bool            free_when_done);
 
+/** 
+* puts a job into the beanstalk server without taking ownership of its data.
+* release is called as soon as the job data was written to the socket (or the kernel reported a zerocopy send
+* of it done, see bsc_set_zerocopy), the buffer may be reused from then on.
+* if the connection is lost after that and before the response arrived the put can not be resent,
+* user_cb is called with BSC_RES_CLIENT_DISCONNECTED once the client reconnected.
+* 
+* @param client       bsc instance
+* @param user_cb      callback on response
+* @param user_data    custom data associated with the callback
+* @param priority     job priority
+* @param delay        job delay start
+* @param ttr          job time to run
+* @param bytes        job length
+* @param data         job data
+* @param release      called with data and release_ctx once data is no longer needed (exactly once)
+* @param release_ctx  custom data passed to release
+* 
+* @return             the error code
+*/
+bsc_error_t bsc_put_w_release(bsc            *client,
+                              bsc_put_user_cb user_cb,
+                              void           *user_data,
+                              uint32_t        priority,
+                              uint32_t        delay,
+                              uint32_t        ttr,
+                              size_t          bytes,
+                              const char     *data,
+                              bsc_release_cb  release,
+                              void           *release_ctx);
+
+/** 
+* puts a job whose data is read from a file descriptor, the data is sent with sendfile (or spliced for pipes)
+* without being copied to user space. the fd must not be closed before release was called, any other
+* kind of fd (a socket included) fails with BSC_ERROR_BAD_FD before anything is queued.
+* data spliced from a pipe can not be resent, like bsc_put_w_release such a put completes
+* with BSC_RES_CLIENT_DISCONNECTED when the connection is lost after its data was sent.
+* a pipe must already hold all bytes of the job when the put is queued, it is spliced without
+* blocking and running dry is taken for a full socket (the put would stall until the next write).
+* 
+* @param client       bsc instance
+* @param user_cb      callback on response
+* @param user_data    custom data associated with the callback
+* @param priority     job priority
+* @param delay        job delay start
+* @param ttr          job time to run
+* @param bytes        job length
+* @param fd           file descriptor to read the job data from
+* @param offset       offset of the job data in a regular file, < 0 to read from a pipe
+* @param release      called with NULL and release_ctx once fd is no longer needed (may be NULL)
+* @param release_ctx  custom data passed to release
+* 
+* @return             the error code
+*/
+bsc_error_t bsc_put_fd(bsc            *client,
+                       bsc_put_user_cb user_cb,
+                       void           *user_data,
+                       uint32_t        priority,
+                       uint32_t        delay,
+                       uint32_t        ttr,
+                       size_t          bytes,
+                       int             fd,
+                       off_t           offset,
+                       bsc_release_cb  release,
+                       void           *release_ctx);
+
+/** 
+* puts count jobs into the beanstalk server in one call. queue space is taken for all of them at once
+* (the whole batch is queued or none of it) and user_cb is called once, after the last job's response,
+* with the responses stored in the jobs. the jobs and their data must stay valid until then.
+* 
+* @param client     bsc instance
+* @param user_cb    callback once all jobs were answered
+* @param user_data  custom data associated with the callback
+* @param jobs       the jobs to put
+* @param count      the number of jobs
+* 
+* @return           the error code
+*/
+bsc_error_t bsc_put_batch(bsc                  *client,
+                          bsc_put_batch_user_cb user_cb,
+                          void                 *user_data,
+                          struct bsc_put_job   *jobs,
+                          size_t                count);
+
+/** 
+* sends job data of at least threshold bytes that is handed back with a release callback (bsc_put_w_release)
+* with MSG_ZEROCOPY, the kernel reads it straight from the buffer. release is delayed until the completion
+* arrives on the socket's error queue, which bsc_read and bsc_write check. other job data is always copied
+* since it is freed or handed back from the put response.
+* the setting survives reconnects, BSC_ZEROCOPY_COMPLETED counts the completed sends.
+* 
+* @param client     bsc instance
+* @param threshold  the minimal job size to send without copying, 0 turns zerocopy off
+* 
+* @return           false when the socket does not support zerocopy (the data is copied then)
+*/
+bool bsc_set_zerocopy(bsc *client, size_t threshold);
+
 /** 
 * instructs the beanstalk server to use "tube" for putting jobs.
 * 
@@ -697,6 +1112,80 @@ bsc_error_t bsc_reserve(bsc                *client,
                         void               *user_data,
                         int32_t             timeout);
 
+/** 
+* reserve a job from the beanstalk server, its body is received straight into a buffer returned by alloc.
+* alloc is called with the body size once the RESERVED header arrived, only the body bytes that came
+* with the header are copied, the rest is read into the buffer directly. response.data points to it
+* in user_cb, it is not NUL terminated and belongs to the caller. when alloc returns NULL the body
+* is received into the client's input buffer as with bsc_reserve.
+* if the connection is lost while the body is received the reserve is resent and alloc is called again,
+* response.data is then the buffer of the attempt that was cut off (NULL otherwise) to be reused or freed.
+* 
+* @param client     bsc instance
+* @param user_cb    callback on response
+* @param user_data  custom data associated with the callback
+* @param timeout    if < 0: issues normal reserve, else: issues reserve_with_timeout
+* @param alloc      returns a buffer of at least bytes bytes (may be NULL)
+* 
+* @return           the error code
+*/
+bsc_error_t bsc_reserve_into(bsc                 *client,
+                             bsc_reserve_user_cb  user_cb,
+                             void                *user_data,
+                             int32_t              timeout,
+                             bsc_reserve_alloc_cb alloc);
+
+/** 
+* reserve a job from the beanstalk server, its body is handed to chunk_cb as it arrives instead of being
+* buffered. user_cb is called first, with the header (response.data is NULL) of a reserved job or with
+* any other response. chunk_cb then gets the body in successive chunks (not NUL terminated, valid during
+* the call only), last is set on the final one (an empty body is a single empty chunk). the chunks are
+* at most the size of the input buffer, which does not grow for the body and body_max does not apply.
+* if the connection is lost while the body is received the reserve is resent and user_cb is called
+* again with the new header, the chunks start over.
+* 
+* @param client     bsc instance
+* @param user_cb    callback on response (the header)
+* @param user_data  custom data associated with the callback
+* @param timeout    if < 0: issues normal reserve, else: issues reserve_with_timeout
+* @param chunk_cb   callback on every chunk of the body
+* 
+* @return           the error code
+*/
+bsc_error_t bsc_reserve_stream(bsc                 *client,
+                               bsc_reserve_user_cb  user_cb,
+                               void                *user_data,
+                               int32_t              timeout,
+                               bsc_reserve_chunk_cb chunk_cb);
+
+/** 
+* detaches the input buffer holding a job body, called from a reserve or peek callback whose
+* response carries the body. response.data stays valid (and NUL terminated) after the callback
+* and the returned buffer must be passed to free once it is no longer used.
+* the client continues reading into a fresh buffer.
+* 
+* @param client     bsc instance
+* 
+* @return           the buffer response.data points into, NULL when out of memory
+*                   (the body has to be copied then), when the buffer was already taken,
+*                   when the body was received into a buffer from bsc_reserve_into
+*                   or when the response carries no body (e.g. TIMED_OUT)
+*/
+void *bsc_job_take(bsc *client);
+
+/** 
+* receives reserved job bodies of threshold bytes or more into an anonymous file (a memfd where
+* available, an unlinked temporary file otherwise) instead of the input buffer, so the heap does not
+* grow with them. user_cb gets a shared mapping of the file in response.data and its descriptor in
+* response.fd, both are closed once user_cb returns, dup the descriptor to keep the body (it can be
+* mapped again or passed to another process). bodies are received into the input buffer when the
+* file can not be created. bodies placed by bsc_reserve_into are not spilled.
+* 
+* @param client     bsc instance
+* @param threshold  the body size to spill at (0 to never spill)
+*/
+void bsc_set_spill(bsc *client, size_t threshold);
+
 /** 
 * deletes a job from the beanstalk server.
 * 
@@ -763,6 +1252,82 @@ bsc_error_t bsc_touch(bsc                *client,
                       void               *user_data,
                       uint64_t            id);
 
+/** 
+* deletes count jobs. the commands are sent back to back from one queue slot and user_cb
+* is called once, after the last response, with the response to each id in response.codes.
+* ids must stay valid until then.
+* 
+* @param client     bsc instance
+* @param user_cb    callback once all ids were answered
+* @param user_data  custom data associated with the callback
+* @param ids        the ids of the jobs to be deleted
+* @param count      the number of ids
+* 
+* @return           the error code
+*/
+bsc_error_t bsc_delete_many(bsc             *client,
+                            bsc_ids_user_cb  user_cb,
+                            void            *user_data,
+                            const uint64_t  *ids,
+                            size_t           count);
+
+/** 
+* touches count reserved jobs, see bsc_delete_many.
+* 
+* @param client     bsc instance
+* @param user_cb    callback once all ids were answered
+* @param user_data  custom data associated with the callback
+* @param ids        the ids of the jobs to be touched
+* @param count      the number of ids
+* 
+* @return           the error code
+*/
+bsc_error_t bsc_touch_many(bsc             *client,
+                           bsc_ids_user_cb  user_cb,
+                           void            *user_data,
+                           const uint64_t  *ids,
+                           size_t           count);
+
+/** 
+* releases count reserved jobs with the same priority and delay, see bsc_delete_many.
+* 
+* @param client     bsc instance
+* @param user_cb    callback once all ids were answered
+* @param user_data  custom data associated with the callback
+* @param ids        the ids of the jobs to be released
+* @param count      the number of ids
+* @param priority   the new priority of the jobs
+* @param delay      the delay before the jobs are put in the ready queue
+* 
+* @return           the error code
+*/
+bsc_error_t bsc_release_many(bsc             *client,
+                             bsc_ids_user_cb  user_cb,
+                             void            *user_data,
+                             const uint64_t  *ids,
+                             size_t           count,
+                             uint32_t         priority,
+                             uint32_t         delay);
+
+/** 
+* buries count reserved jobs with the same priority, see bsc_delete_many.
+* 
+* @param client     bsc instance
+* @param user_cb    callback once all ids were answered
+* @param user_data  custom data associated with the callback
+* @param ids        the ids of the jobs to be buried
+* @param count      the number of ids
+* @param priority   the new priority of the jobs
+* 
+* @return           the error code
+*/
+bsc_error_t bsc_bury_many(bsc             *client,
+                          bsc_ids_user_cb  user_cb,
+                          void            *user_data,
+                          const uint64_t  *ids,
+                          size_t           count,
+                          uint32_t         priority);
+
 /** 
 * adds the named tube to the watch list for the current connection.
 * 
@@ -43,14 +43,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "beanstalkproto.h"
 
 #define  CSTRLEN(cstr) (sizeof(cstr)/sizeof(char)-1)
-#define  MACRO2STR_(m) #m
-#define  MACRO2STR(m) MACRO2STR_(m)
-#define  UINT32_STRL ( CSTRLEN(MACRO2STR(UINT32_MAX)) )
-#define  UINT64_STRL ( CSTRLEN(MACRO2STR(UINT64_MAX)) )
+
+/* the longest decimal representations of uint32_t and uint64_t */
+#define  UINT32_DIGITS 10
+#define  UINT64_DIGITS 20
 
 
 static const char *bsp_response_str[] = {
@@ -106,26 +111,50 @@ static const size_t bsp_response_strlen[] = {
     CSTRLEN("PAUSED")
 };
 
-#define GEN_STATIC_CMD(cmd_name, str)                                \
-char *bsp_gen_ ## cmd_name ## _cmd(int *cmd_len, bool *is_allocated) \
-{                                                                    \
-    static const char cmd[] = (str);                                 \
-    *cmd_len = CSTRLEN(cmd);                                         \
-    *is_allocated = false;                                           \
-    return (char *)cmd;                                              \
-}
-
-#define INIT_CMD_MALLOC(...)                                            \
-    char *cmd   = NULL;                                                 \
-    *is_allocated = true;                                               \
-    if ( ( cmd = (char *)malloc( sizeof(char) * alloc_len ) ) == NULL ) \
-        return NULL;                                                    \
-    if ( ( *cmd_len = sprintf(cmd, format, ##__VA_ARGS__ ) ) < 0 ) {    \
-        free(cmd);                                                      \
-        return NULL;                                                    \
-    }                                                                   \
+/* static commands are copied into buf so they can be sent along with their neighbours */
+#define GEN_STATIC_CMD(cmd_name, str)                                           \
+char *bsp_gen_ ## cmd_name ## _cmd(char *buf, int *cmd_len, bool *is_allocated) \
+{                                                                               \
+    static const char cmd[] = (str);                                            \
+    *cmd_len = CSTRLEN(cmd);                                                    \
+    *is_allocated = false;                                                      \
+    if (buf == NULL)                                                            \
+        return (char *)cmd;                                                     \
+    return memcpy(buf, cmd, CSTRLEN(cmd));                                      \
+}
+
+/* encodes into buf when the command fits, otherwise into a newly allocated string */
+#define INIT_CMD_BUF(max_len)                                                       \
+    char *cmd = NULL, *p = NULL;                                                    \
+    if ( buf != NULL && (max_len) <= BSP_CMD_BUF_LEN ) {                            \
+        cmd = buf;                                                                  \
+        *is_allocated = false;                                                      \
+    }                                                                               \
+    else if ( ( cmd = (char *)malloc( sizeof(char) * (max_len) ) ) == NULL )        \
+        return NULL;                                                                \
+    else                                                                            \
+        *is_allocated = true;                                                       \
+    p = cmd;
+
+#define FIN_CMD                 \
+    p = PUT_CSTR(p, CRLF);      \
+    *cmd_len = p - cmd;         \
     return cmd;
 
+#define PUT_CSTR(p, cstr) ( memcpy( (p), (cstr), CSTRLEN(cstr) ), (p) + CSTRLEN(cstr) )
+#define PUT_STR(p, str, len) ( memcpy( (p), (str), (len) ), (p) + (len) )
+
+static inline char *put_uint(char *p, uint64_t n)
+{
+    char digits[UINT64_DIGITS], *d = digits + UINT64_DIGITS;
+
+    do {
+        *--d = '0' + n % 10;
+        n /= 10;
+    } while (n);
+
+    return PUT_STR(p, d, digits + UINT64_DIGITS - d);
+}
 
 #define GET_ID_BYTES                                                                \
     p =  (char *)response + bsp_response_strlen[response_t] + 1;                    \
@@ -170,27 +199,26 @@ static const bsc_response_t bsp_general_error_responses[] = {
  * producer methods
  *-----------------------------------------------------------------------------*/
 
-char *bsp_gen_put_hdr(int       *hdr_len,
-                      bool *is_allocated,
+char *bsp_gen_put_hdr(char      *buf,
+                      int       *cmd_len,
+                      bool      *is_allocated,
                       uint32_t   priority,
                       uint32_t   delay,
                       uint32_t   ttr,
                       size_t     bytes)
 {
-    static const char   format[]  = "put %u %u %u %u\r\n";
-    static const size_t alloc_len = CSTRLEN(format) + (UINT32_STRL - CSTRLEN("%u")) * 4 + 1;
-
-    *is_allocated = true;
-    char *hdr   = NULL;
-
-    if ( ( hdr = (char *)malloc( sizeof(char) * alloc_len ) ) == NULL )
-        return NULL;
-
-    if ( ( *hdr_len = sprintf(hdr, format, priority, delay, ttr, bytes) ) < 0 ) {
-        free(hdr);
-        return NULL;
-    }
-    return hdr;
+    static const size_t max_len = CSTRLEN("put    " CRLF) + UINT32_DIGITS * 3 + UINT64_DIGITS;
+
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "put ");
+    p = put_uint(p, priority);
+    *p++ = ' ';
+    p = put_uint(p, delay);
+    *p++ = ' ';
+    p = put_uint(p, ttr);
+    *p++ = ' ';
+    p = put_uint(p, bytes);
+    FIN_CMD
 }
     
 bsc_response_t bsp_get_put_res(const char *response, uint64_t *id)
@@ -213,13 +241,14 @@ bsc_response_t bsp_get_put_res(const char *response, uint64_t *id)
     return response_t;
 }
 
-char *bsp_gen_use_cmd(int *cmd_len, bool *is_allocated, const char *tube_name)
+char *bsp_gen_use_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name)
 {
-    static const char   format[]   = "use %s\r\n";
-    static const size_t format_len = CSTRLEN(format) - CSTRLEN("%s") + 1;
+    size_t tube_len = strlen(tube_name);
 
-    size_t alloc_len = format_len + strlen(tube_name);
-    INIT_CMD_MALLOC(tube_name)
+    INIT_CMD_BUF(CSTRLEN("use " CRLF) + tube_len)
+    p = PUT_CSTR(p, "use ");
+    p = PUT_STR(p, tube_name, tube_len);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_use_res(const char *response, char **tube_name)
@@ -252,12 +281,14 @@ bsc_response_t bsp_get_use_res(const char *response, char **tube_name)
 
 GEN_STATIC_CMD(reserve, "reserve\r\n")
 
-char *bsp_gen_reserve_with_to_cmd(int *cmd_len, bool *is_allocated, uint32_t timeout)
+char *bsp_gen_reserve_with_to_cmd(char *buf, int *cmd_len, bool *is_allocated, uint32_t timeout)
 {
-    static const char   format[]  = "reserve-with-timeout %u\r\n";
-    static const size_t alloc_len = CSTRLEN(format) - CSTRLEN("%u") + UINT32_STRL + 1;
+    static const size_t max_len = CSTRLEN("reserve-with-timeout " CRLF) + UINT32_DIGITS;
 
-    INIT_CMD_MALLOC(timeout)
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "reserve-with-timeout ");
+    p = put_uint(p, timeout);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_reserve_res(const char *response, uint64_t *id, size_t *bytes)
@@ -279,12 +310,14 @@ bsc_response_t bsp_get_reserve_res(const char *response, uint64_t *id, size_t *b
     return response_t;
 }
 
-char *bsp_gen_delete_cmd(int *cmd_len, bool *is_allocated, uint64_t id)
+char *bsp_gen_delete_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id)
 {
-    static const char   format[]  = "delete %llu\r\n";
-    static const size_t alloc_len = CSTRLEN(format) - CSTRLEN("%llu") + UINT64_STRL + 1;
+    static const size_t max_len = CSTRLEN("delete " CRLF) + UINT64_DIGITS;
 
-    INIT_CMD_MALLOC(id)
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "delete ");
+    p = put_uint(p, id);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_delete_res(const char *response)
@@ -299,12 +332,18 @@ bsc_response_t bsp_get_delete_res(const char *response)
     return response_t;
 }
 
-char *bsp_gen_release_cmd(int *cmd_len, bool *is_allocated, uint64_t id, uint32_t priority, uint32_t delay)
+char *bsp_gen_release_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id, uint32_t priority, uint32_t delay)
 {
-    static const char   format[]  = "release %llu %u %u\r\n";
-    static const size_t alloc_len = CSTRLEN(format) + UINT64_STRL - CSTRLEN("%llu") + (UINT32_STRL - CSTRLEN("%u")) * 2 + 1;
-
-    INIT_CMD_MALLOC(id, priority, delay)
+    static const size_t max_len = CSTRLEN("release   " CRLF) + UINT64_DIGITS + UINT32_DIGITS + UINT32_DIGITS;
+
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "release ");
+    p = put_uint(p, id);
+    *p++ = ' ';
+    p = put_uint(p, priority);
+    *p++ = ' ';
+    p = put_uint(p, delay);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_release_res(const char *response)
@@ -320,12 +359,16 @@ bsc_response_t bsp_get_release_res(const char *response)
     return response_t;
 }
 
-char *bsp_gen_bury_cmd(int *cmd_len, bool *is_allocated, uint64_t id, uint32_t priority)
+char *bsp_gen_bury_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id, uint32_t priority)
 {
-    static const char   format[]  = "bury %llu %u\r\n";
-    static const size_t alloc_len = CSTRLEN(format) + UINT64_STRL - CSTRLEN("%llu") + UINT32_STRL - CSTRLEN("%u") + 1;
-
-    INIT_CMD_MALLOC(id, priority)
+    static const size_t max_len = CSTRLEN("bury  " CRLF) + UINT64_DIGITS + UINT32_DIGITS;
+
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "bury ");
+    p = put_uint(p, id);
+    *p++ = ' ';
+    p = put_uint(p, priority);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_bury_res(const char *response)
@@ -340,12 +383,14 @@ bsc_response_t bsp_get_bury_res(const char *response)
     return response_t;
 }
 
-char *bsp_gen_touch_cmd(int *cmd_len, bool *is_allocated, uint64_t id)
+char *bsp_gen_touch_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id)
 {
-    static const char   format[]  = "touch %llu\r\n";
-    static const size_t alloc_len = CSTRLEN(format) + UINT64_STRL - CSTRLEN("%llu") + 1;
+    static const size_t max_len = CSTRLEN("touch " CRLF) + UINT64_DIGITS;
 
-    INIT_CMD_MALLOC(id)
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "touch ");
+    p = put_uint(p, id);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_touch_res(const char *response)
@@ -360,13 +405,14 @@ bsc_response_t bsp_get_touch_res(const char *response)
     return response_t;
 }
 
-char *bsp_gen_watch_cmd(int *cmd_len, bool *is_allocated, const char *tube_name)
+char *bsp_gen_watch_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name)
 {
-    static const char   format[]   = "watch %s\r\n";
-    static const size_t format_len = CSTRLEN(format) - CSTRLEN("%s") + 1;
+    size_t tube_len = strlen(tube_name);
 
-    size_t alloc_len = format_len + strlen(tube_name);
-    INIT_CMD_MALLOC(tube_name)
+    INIT_CMD_BUF(CSTRLEN("watch " CRLF) + tube_len)
+    p = PUT_CSTR(p, "watch ");
+    p = PUT_STR(p, tube_name, tube_len);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_watch_res(const char *response, uint32_t *count)
@@ -392,13 +438,14 @@ bsc_response_t bsp_get_watch_res(const char *response, uint32_t *count)
     return response_t;
 }
 
-char *bsp_gen_ignore_cmd(int *cmd_len, bool *is_allocated, const char *tube_name)
+char *bsp_gen_ignore_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name)
 {
-    static const char   format[]   = "ignore %s\r\n";
-    static const size_t format_len = CSTRLEN(format) - CSTRLEN("%s") + 1;
+    size_t tube_len = strlen(tube_name);
 
-    size_t alloc_len = format_len + strlen(tube_name);
-    INIT_CMD_MALLOC(tube_name)
+    INIT_CMD_BUF(CSTRLEN("ignore " CRLF) + tube_len)
+    p = PUT_CSTR(p, "ignore ");
+    p = PUT_STR(p, tube_name, tube_len);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_ignore_res(const char *response, uint32_t *count)
@@ -429,12 +476,14 @@ bsc_response_t bsp_get_ignore_res(const char *response, uint32_t *count)
  * other methods
  *-----------------------------------------------------------------------------*/
 
-char *bsp_gen_peek_cmd(int *cmd_len, bool *is_allocated, uint64_t id)
+char *bsp_gen_peek_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id)
 {
-    static const char   format[]  = "peek %llu\r\n";
-    static const size_t alloc_len = CSTRLEN(format) + UINT64_STRL - CSTRLEN("%llu") + 1;
+    static const size_t max_len = CSTRLEN("peek " CRLF) + UINT64_DIGITS;
 
-    INIT_CMD_MALLOC(id)
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "peek ");
+    p = put_uint(p, id);
+    FIN_CMD
 }
 
 GEN_STATIC_CMD(peek_ready, "peek-ready\r\n")
@@ -459,12 +508,14 @@ bsc_response_t bsp_get_peek_res(const char *response, uint64_t *id, size_t *byte
     return response_t;
 }
 
-char *bsp_gen_kick_cmd(int *cmd_len, bool *is_allocated, uint32_t bound)
+char *bsp_gen_kick_cmd(char *buf, int *cmd_len, bool *is_allocated, uint32_t bound)
 {
-    static const char   format[]  = "kick %u\r\n";
-    static const size_t alloc_len = CSTRLEN(format) + UINT32_STRL - CSTRLEN("%u") + 1;
+    static const size_t max_len = CSTRLEN("kick " CRLF) + UINT32_DIGITS;
 
-    INIT_CMD_MALLOC(bound)
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "kick ");
+    p = put_uint(p, bound);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_kick_res(const char *response, uint32_t *count)
@@ -490,13 +541,16 @@ bsc_response_t bsp_get_kick_res(const char *response, uint32_t *count)
 
 GEN_STATIC_CMD(quit, "quit\r\n")
 
-char *bsp_gen_pause_tube_cmd(int *cmd_len, bool *is_allocated, const char *tube_name, uint32_t delay)
+char *bsp_gen_pause_tube_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name, uint32_t delay)
 {
-    static const char   format[]   = "pause-tube %s %u\r\n";
-    static const size_t format_len = CSTRLEN(format) - CSTRLEN("%s") + UINT32_STRL - CSTRLEN("%u") + 1;
-
-    size_t alloc_len = format_len + strlen(tube_name);
-    INIT_CMD_MALLOC(tube_name, delay)
+    size_t tube_len = strlen(tube_name);
+
+    INIT_CMD_BUF(CSTRLEN("pause-tube  " CRLF) + tube_len + UINT32_DIGITS)
+    p = PUT_CSTR(p, "pause-tube ");
+    p = PUT_STR(p, tube_name, tube_len);
+    *p++ = ' ';
+    p = put_uint(p, delay);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_pause_tube_res(const char *response)
@@ -551,12 +605,14 @@ bsc_response_t bsp_get_pause_tube_res(const char *response)
  * job stats
  *-----------------------------------------------------------------------------*/
 
-char *bsp_gen_stats_job_cmd(size_t *cmd_len, bool *is_allocated, uint64_t id)
+char *bsp_gen_stats_job_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id)
 {
-    static const char   format[]  = "stats-job %llu\r\n";
-    static const size_t alloc_len = CSTRLEN(format) + UINT64_STRL - CSTRLEN("%llu") + 1;
+    static const size_t max_len = CSTRLEN("stats-job " CRLF) + UINT64_DIGITS;
 
-    INIT_CMD_MALLOC(id)
+    INIT_CMD_BUF(max_len)
+    p = PUT_CSTR(p, "stats-job ");
+    p = put_uint(p, id);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_stats_job_res(const char *response, size_t *bytes)
@@ -661,13 +717,14 @@ void bsc_job_stats_free(bsc_job_stats *job)
  * tube stats
  *-----------------------------------------------------------------------------*/
 
-char *bsp_gen_stats_tube_cmd(int *cmd_len, bool *is_allocated, const char *tube_name)
+char *bsp_gen_stats_tube_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name)
 {
-    static const char   format[]  = "stats-tube %s\r\n";
-    static const size_t format_len = CSTRLEN(format) - CSTRLEN("%s") + 1;
+    size_t tube_len = strlen(tube_name);
 
-    size_t alloc_len = format_len + strlen(tube_name);
-    INIT_CMD_MALLOC(tube_name)
+    INIT_CMD_BUF(CSTRLEN("stats-tube " CRLF) + tube_len)
+    p = PUT_CSTR(p, "stats-tube ");
+    p = PUT_STR(p, tube_name, tube_len);
+    FIN_CMD
 }
 
 bsc_response_t bsp_get_stats_tube_res(const char *response, size_t *bytes)
@@ -954,6 +1011,39 @@ char **bsp_parse_tube_list(const char *data)
     return tube_list;
 }
 
+/*-----------------------------------------------------------------------------
+ * framing
+ *-----------------------------------------------------------------------------*/
+
+size_t bsp_scan_lf(const char *data, size_t len, size_t *pos, size_t max, size_t *scanned)
+{
+    size_t   i = 0, n = 0;
+    uint32_t mask;
+#if defined(__AVX2__)
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    /* a block is only scanned when all of its line feeds fit */
+    for (; i + 32 <= len && n + 32 <= max; i += 32)
+        for ( mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + i)), lf));
+              mask; mask &= mask - 1 )
+            pos[n++] = i + __builtin_ctz(mask);
+#elif defined(__SSE2__)
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    for (; i + 16 <= len && n + 16 <= max; i += 16)
+        for ( mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + i)), lf));
+              mask; mask &= mask - 1 )
+            pos[n++] = i + __builtin_ctz(mask);
+#endif
+
+    for (; i < len && n < max; ++i)
+        if (data[i] == '\n')
+            pos[n++] = i;
+
+    *scanned = i;
+    return n;
+}
+
 /*
  * template for creating strlen arrays
     static const char const *keys[] = {
@@ -47,6 +47,10 @@
 
 #define  CRLF "\r\n"
 
+/* the longest command that is always encoded into a caller supplied buffer (a put header, with room
+ * to spare for the CRLF that ends its body) */
+#define  BSP_CMD_BUF_LEN 64
+
 /*-----------------------------------------------------------------------------
  * producer methods
  *-----------------------------------------------------------------------------*/
@@ -54,7 +58,8 @@
 /** 
 * generates a put command header
 * 
-* @param hdr_len      pointer to store length of the generated hdr
+* @param buf          a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
+* @param cmd_len      pointer to store length of the generated hdr
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param priority     the job's priority
 * @param delay        the job's start delay
@@ -63,7 +68,8 @@
 * 
 * @return the serialized header
 */
-char *bsp_gen_put_hdr(int       *hdr_len,
+char *bsp_gen_put_hdr(char      *buf,
+                      int       *cmd_len,
                       bool      *is_allocated,
                       uint32_t   priority,
                       uint32_t   delay,
@@ -83,13 +89,14 @@ bsc_response_t bsp_get_put_res(const char *response, uint64_t *id);
 /** 
 * generates a use command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param tube_name  the tube name..
 * 
 * @return the serialized command
 */
-char *bsp_gen_use_cmd(int *cmd_len, bool *is_allocated, const char *tube_name);
+char *bsp_gen_use_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name);
 
 /** 
 * parses response from the use command
@@ -108,23 +115,25 @@ bsc_response_t bsp_get_use_res(const char *response, char **tube_name);
 /** 
 * generates a reserve command
 * 
+* @param buf         a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len     pointer to store the generated command's length in
 * @param is_allocated  pointer to store weather the generated string is to be freed
 * 
 * @return the serialized command
 */
-char *bsp_gen_reserve_cmd(int *cmd_len, bool *is_allocated);
+char *bsp_gen_reserve_cmd(char *buf, int *cmd_len, bool *is_allocated);
 
 /** 
 * generates a reserve with timeout command
 * 
+* @param buf         a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len     pointer to store the generated command's length in
 * @param is_allocated  pointer to store weather the generated string is to be freed
 * @param timeout     timeout in seconds
 * 
 * @return the serialized command
 */
-char *bsp_gen_reserve_with_to_cmd(int *cmd_len, bool *is_allocated, uint32_t timeout);
+char *bsp_gen_reserve_with_to_cmd(char *buf, int *cmd_len, bool *is_allocated, uint32_t timeout);
 
 /** 
 * parses a response to the reserve command
@@ -140,13 +149,14 @@ bsc_response_t bsp_get_reserve_res(const char *response, uint64_t *id, size_t *b
 /** 
 * generates a delete command
 * 
+* @param buf         a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len     pointer to store the generated command's length in
 * @param is_allocated  pointer to store weather the generated string is to be freed
 * @param id          the to be deleted job's id
 * 
 * @return the serialized command
 */
-char *bsp_gen_delete_cmd(int *cmd_len, bool *is_allocated, uint64_t id);
+char *bsp_gen_delete_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id);
 
 /** 
 * parses a response to the delete command
@@ -160,6 +170,7 @@ bsc_response_t bsp_get_delete_res(const char *response);
 /** 
 * generates a release command
 * 
+* @param buf         a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len     pointer to store the generated command's length in
 * @param is_allocated  pointer to store weather the generated string is to be freed
 * @param id          the to be released job's id
@@ -168,7 +179,7 @@ bsc_response_t bsp_get_delete_res(const char *response);
 * 
 * @return the serialized command
 */
-char *bsp_gen_release_cmd(int *cmd_len, bool *is_allocated, uint64_t id, uint32_t priority, uint32_t delay);
+char *bsp_gen_release_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id, uint32_t priority, uint32_t delay);
 
 /** 
 * parses a response to the release command
@@ -182,6 +193,7 @@ bsc_response_t bsp_get_release_res(const char *response);
 /** 
 * generates a bury command
 * 
+* @param buf         a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len     pointer to store the generated command's length in
 * @param is_allocated  pointer to store weather the generated string is to be freed
 * @param id          the to be buried job's id
@@ -189,7 +201,7 @@ bsc_response_t bsp_get_release_res(const char *response);
 * 
 * @return the serialized command
 */
-char *bsp_gen_bury_cmd(int *cmd_len, bool *is_allocated, uint64_t id, uint32_t priority);
+char *bsp_gen_bury_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id, uint32_t priority);
 
 /** 
 * parses a response to the bury command
@@ -203,13 +215,14 @@ bsc_response_t bsp_get_bury_res(const char *response);
 /** 
 * generates a touch command
 * 
+* @param buf         a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len     pointer to store the generated command's length in
 * @param is_allocated  pointer to store weather the generated string is to be freed
 * @param id          the to be touched job's id
 * 
 * @return the serialized command
 */
-char *bsp_gen_touch_cmd(int *cmd_len, bool *is_allocated, uint64_t id);
+char *bsp_gen_touch_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id);
 
 /** 
 * parses a response to the touch command
@@ -223,13 +236,14 @@ bsc_response_t bsp_get_touch_res(const char *response);
 /** 
 * generates a watch command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param tube_name  the tube name
 * 
 * @return the serialized command
 */
-char *bsp_gen_watch_cmd(int *cmd_len, bool *is_allocated, const char *tube_name);
+char *bsp_gen_watch_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name);
 
 /** 
 * parses a response to the watch command
@@ -244,13 +258,14 @@ bsc_response_t bsp_get_watch_res(const char *response, uint32_t *count);
 /** 
 * generates an ignore command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param tube_name  the tube name
 * 
 * @return the serialized command
 */
-char *bsp_gen_ignore_cmd(int *cmd_len, bool *is_allocated, const char *tube_name);
+char *bsp_gen_ignore_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name);
 
 /** 
 * parses a response to the ignore command
@@ -269,43 +284,47 @@ bsc_response_t bsp_get_ignore_res(const char *response, uint32_t *count);
 /** 
 * generates a peek command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param id         the id of the job to be peeked
 * 
 * @return the serialized command
 */
-char *bsp_gen_peek_cmd(int *cmd_len, bool *is_allocated, uint64_t id);
+char *bsp_gen_peek_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id);
 
 /** 
 * generates a peek-ready command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * 
 * @return the serialized command
 */
-char *bsp_gen_peek_ready_cmd(int *cmd_len, bool *is_allocated);
+char *bsp_gen_peek_ready_cmd(char *buf, int *cmd_len, bool *is_allocated);
 
 /** 
 * generates a peek-delayed command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * 
 * @return the serialized command
 */
-char *bsp_gen_peek_delayed_cmd(int *cmd_len, bool *is_allocated);
+char *bsp_gen_peek_delayed_cmd(char *buf, int *cmd_len, bool *is_allocated);
 
 /** 
 * generates a peek-buried command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * 
 * @return the serialized command
 */
-char *bsp_gen_peek_buried_cmd(int *cmd_len, bool *is_allocated);
+char *bsp_gen_peek_buried_cmd(char *buf, int *cmd_len, bool *is_allocated);
 
 /** 
 * parses a response to the peek command
@@ -321,13 +340,14 @@ bsc_response_t bsp_get_peek_res(const char *response, uint64_t *id, size_t *byte
 /** 
 * generates a kick command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param bound      maximum jobs to kick
 * 
 * @return the serialized command
 */
-char *bsp_gen_kick_cmd(int *cmd_len, bool *is_allocated, uint32_t bound);
+char *bsp_gen_kick_cmd(char *buf, int *cmd_len, bool *is_allocated, uint32_t bound);
 
 /** 
 * parses a response to the kick command
@@ -342,16 +362,18 @@ bsc_response_t bsp_get_kick_res(const char *response, uint32_t *count);
 /** 
 * generates a quit command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * 
 * @return the serialized command
 */
-char *bsp_gen_quit_cmd(int *cmd_len, bool *is_allocated);
+char *bsp_gen_quit_cmd(char *buf, int *cmd_len, bool *is_allocated);
 
 /** 
 * generates a pause-tube command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param tube_name  the tube's name
@@ -359,7 +381,7 @@ char *bsp_gen_quit_cmd(int *cmd_len, bool *is_allocated);
 * 
 * @return the serialized command
 */
-char *bsp_gen_pause_tube_cmd(int *cmd_len, bool *is_allocated, const char *tube_name, uint32_t delay);
+char *bsp_gen_pause_tube_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name, uint32_t delay);
 
 /** 
 * parses a response to the pause-tube command
@@ -377,13 +399,14 @@ bsc_response_t bsp_get_pause_tube_res(const char *response);
 /** 
 * generates a stats-job command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param id         the id of the job to be queried
 * 
 * @return the serialized command
 */
-char *bsp_gen_stats_job_cmd(size_t *cmd_len, bool *is_allocated, uint64_t id);
+char *bsp_gen_stats_job_cmd(char *buf, int *cmd_len, bool *is_allocated, uint64_t id);
 
 /** 
 * parses a response to the stats-job command
@@ -411,13 +434,14 @@ bsc_job_stats *bsp_parse_job_stats(const char *data);
 /** 
 * generates a stats-tube command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * @param tube_name  the tube's name
 * 
 * @return the serialized command
 */
-char *bsp_gen_stats_tube_cmd(int *cmd_len, bool *is_allocated, const char *tube_name);
+char *bsp_gen_stats_tube_cmd(char *buf, int *cmd_len, bool *is_allocated, const char *tube_name);
 
 /** 
 * parses a response to the stats-tube command
@@ -445,12 +469,13 @@ bsc_tube_stats *bsp_parse_tube_stats(const char *data);
 /** 
 * generates a stats command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * 
 * @return the serialized command
 */
-char *bsp_gen_stats_cmd(int *cmd_len, bool *is_allocated);
+char *bsp_gen_stats_cmd(char *buf, int *cmd_len, bool *is_allocated);
 
 /** 
 * parses a response to the stats command
@@ -478,22 +503,24 @@ bsc_server_stats *bsp_parse_server_stats(const char *data);
 /** 
 * generates a list tubes command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * 
 * @return the serialized command
 */
-char *bsp_gen_list_tubes_cmd(int *cmd_len, bool *is_allocated);
+char *bsp_gen_list_tubes_cmd(char *buf, int *cmd_len, bool *is_allocated);
 
 /** 
 * generates a list tubes watched command
 * 
+* @param buf        a BSP_CMD_BUF_LEN sized buffer to encode into (NULL to allocate)
 * @param cmd_len    pointer to store the generated command's length in
 * @param is_allocated pointer to store weather the generated string is to be freed
 * 
 * @return the serialized command
 */
-char *bsp_gen_list_tubes_watched_cmd(int *cmd_len, bool *is_allocated);
+char *bsp_gen_list_tubes_watched_cmd(char *buf, int *cmd_len, bool *is_allocated);
 
 /** 
 * parses a response to the list-tubes command
@@ -514,6 +541,27 @@ bsc_response_t bsp_get_list_tubes_res(const char *response, size_t *bytes);
 */
 char **bsp_parse_tube_list(const char *data);
 
+/*-----------------------------------------------------------------------------
+ * framing
+ *-----------------------------------------------------------------------------*/
+
+/* the line feeds read_responses indexes at a time */
+#define BSP_LF_BATCH 256
+
+/** 
+* finds the line feeds in data in a single (SSE2/AVX2 when compiled in) pass.
+* stops early when max were found, scanned tells where to resume.
+* 
+* @param data     the data to scan
+* @param len      the length of data
+* @param pos      an array to store the offsets of the line feeds in
+* @param max      the size of pos
+* @param scanned  a pointer to store the number of bytes scanned
+* 
+* @return the number of line feeds found
+*/
+size_t bsp_scan_lf(const char *data, size_t len, size_t *pos, size_t max, size_t *scanned);
+
 #ifdef __cplusplus
 }
 #endif
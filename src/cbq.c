@@ -54,15 +54,30 @@ cbq *cbq_new(size_t size)
     if ( ( cmd_info = (union bsc_cmd_info *)malloc(sizeof(union bsc_cmd_info) * size) ) == NULL )
         goto cmd_info_malloc_error;
 
+    if ( ( q->info_chunks = (union bsc_cmd_info **)malloc(sizeof(union bsc_cmd_info *)) ) == NULL )
+        goto info_chunks_malloc_error;
+
+    /* one spare command length covers the gap left behind when the arena wraps */
+    q->cmd_size = (size + 1) * BSP_CMD_BUF_LEN + 1;
+    if ( ( q->cmd_data = (char *)malloc(sizeof(char) * q->cmd_size) ) == NULL )
+        goto cmd_data_malloc_error;
+
     for (i = 0; i < size; ++i)
         q->nodes[i].cb_data = cmd_info+i;
 
+    q->info_chunks[0]  = cmd_info;
+    q->info_chunks_len = 1;
     q->size = size;
     q->rear = q->front = 0;
     q->used = 0;
+    q->cmd_som = q->cmd_eom = q->cmd_data;
 
     return q;
 
+cmd_data_malloc_error:
+    free(q->info_chunks);
+info_chunks_malloc_error:
+    free(cmd_info);
 cmd_info_malloc_error:
     free(q->nodes);
 node_malloc_error:
@@ -74,6 +89,90 @@ void cbq_free(cbq *q)
 {
     while ( !AQ_EMPTY(q) )
         CBQ_DEQ_FIN(q);
-    free(q->nodes[0].cb_data);
+    while (q->info_chunks_len)
+        free(q->info_chunks[--q->info_chunks_len]);
+    free(q->info_chunks);
+    free(q->nodes);
+    free(q->cmd_data);
     free(q);
 }
+
+bool cbq_resize(cbq *q, size_t size)
+{
+    cbq_node *nodes = NULL;
+    union bsc_cmd_info *cmd_info = NULL, **info_chunks = NULL;
+    char *cmd_data = NULL;
+    size_t cmd_size = (size + 1) * BSP_CMD_BUF_LEN + 1;
+    register size_t i;
+
+    if ( size == 0 || ( !AQ_EMPTY(q) && size < q->size ) )
+        return false;
+
+    if ( ( nodes = (cbq_node *)malloc(sizeof(cbq_node) * size) ) == NULL )
+        return false;
+
+    if (AQ_EMPTY(q)) {
+        /* nothing refers to the command info or the arena, both are replaced */
+        if ( ( cmd_info = (union bsc_cmd_info *)malloc(sizeof(union bsc_cmd_info) * size) ) == NULL )
+            goto cmd_info_malloc_error;
+        if ( ( cmd_data = (char *)malloc(sizeof(char) * cmd_size) ) == NULL )
+            goto cmd_data_malloc_error;
+
+        while (q->info_chunks_len > 1)
+            free(q->info_chunks[--q->info_chunks_len]);
+        free(q->info_chunks[0]);
+        q->info_chunks[0] = cmd_info;
+        free(q->cmd_data);
+        q->cmd_data = q->cmd_som = q->cmd_eom = cmd_data;
+        q->cmd_size = cmd_size;
+
+        for (i = 0; i < size; ++i)
+            nodes[i].cb_data = cmd_info+i;
+    }
+    else {
+        if ( size > q->size ) {
+            if ( ( cmd_info = (union bsc_cmd_info *)malloc(sizeof(union bsc_cmd_info) * (size - q->size)) ) == NULL )
+                goto cmd_info_malloc_error;
+            if ( ( info_chunks = (union bsc_cmd_info **)realloc(q->info_chunks,
+                    sizeof(union bsc_cmd_info *) * (q->info_chunks_len + 1)) ) == NULL )
+                goto cmd_data_malloc_error;
+            q->info_chunks = info_chunks;
+            q->info_chunks[q->info_chunks_len++] = cmd_info;
+        }
+
+        /* the pending nodes move to the start of the new ring, the free ones keep their command info */
+        for (i = 0; i < q->size; ++i)
+            nodes[i] = *AQ_NTH_(q, i);
+        for (; i < size; ++i)
+            nodes[i].cb_data = cmd_info + i - q->size;
+    }
+
+    free(q->nodes);
+    q->nodes = nodes;
+    q->size  = size;
+    q->rear  = 0;
+    q->front = q->used % size;
+
+    return true;
+
+cmd_data_malloc_error:
+    free(cmd_info);
+cmd_info_malloc_error:
+    free(nodes);
+    return false;
+}
+
+char *cbq_cmd_reserve(cbq *q)
+{
+    if (q->cmd_som <= q->cmd_eom) {
+        if (q->cmd_data + q->cmd_size - q->cmd_eom >= BSP_CMD_BUF_LEN)
+            return q->cmd_eom;
+        /* wrap around, the tail end stays unused until cmd_som passes it */
+        if (q->cmd_som - q->cmd_data > BSP_CMD_BUF_LEN)
+            return q->cmd_data;
+    }
+    else if (q->cmd_som - q->cmd_eom > BSP_CMD_BUF_LEN)
+        return q->cmd_eom;
+
+    return NULL;
+}
@@ -45,6 +45,7 @@
 
 #include <arrayqueue.h>
 #include "beanstalkclient.h"
+#include "beanstalkproto.h"
 
 struct _cbq_node;
 union  bsc_cmd_info;
@@ -56,25 +57,111 @@ struct _cbq_node {
     int    len;
     bool   is_allocated;
     size_t bytes_expected;
-    off_t  outq_offset;
+    size_t responses_left;      /* response lines expected after the current one */
+    uint64_t out_start;         /* the bytes the command (with its body) takes in the output stream */
+    uint64_t out_end;
     union  bsc_cmd_info *cb_data;
     bsc_cb_p_t cb;
 };
 
-AQ_DEFINE_STRUCT(_cbq, struct _cbq_node);
+/* 
+ * the queue owns a command arena, the commands of pending nodes are encoded into it
+ * back to back and released in fifo order as their responses arrive.
+ * cmd_som points to the oldest pending command and cmd_eom to the end of the newest.
+ */
+struct _cbq {
+    AQ_STRUCT_FIELDS(struct _cbq_node)
+    char   *cmd_data;
+    char   *cmd_som;
+    char   *cmd_eom;
+    size_t  cmd_size;
+    union bsc_cmd_info **info_chunks;
+    size_t  info_chunks_len;
+};
 
 typedef struct _cbq_node cbq_node;
 typedef struct _cbq      cbq;
 
-#define CBQ_ENQ_FIN(c) (AQ_ENQ_FIN((c)->cbqueue), (c)->buffer_fill_cb != NULL ? (c)->buffer_fill_cb(c) : 0)
+/* compared with the bytes written to the output stream */
+#define CBQ_NODE_WRITTEN(node, written) ( (written) >= (node)->out_end )
+
+#define CBQ_CMD_OWNS(q, p) ( (char *)(p) >= (q)->cmd_data && (char *)(p) < (q)->cmd_data + (q)->cmd_size )
+
+#define CBQ_CMD_COMMIT(q, node) \
+    ( CBQ_CMD_OWNS(q, (node)->data) ? (q)->cmd_eom = (char *)(node)->data + (node)->len : NULL )
+
+/* with a flush policy, commands are held back until one of its limits is reached or its timer fires */
+#define CBQ_FLUSH_HOLD(c)                                                           \
+    ( (c)->flush_timer_cb != NULL && !(c)->corked                                   \
+      && (c)->outq->bytes_queued - (c)->outq->bytes_written < (c)->flush_bytes      \
+      && (c)->cbqueue->used - bsc_cmds_in_flight(c) < (c)->flush_cmds )
+
+/* 
+ * producers are told to pause once high commands are pending, a corked client notifies the host once it is uncorked.
+ * with eager_write, commands that start at an idle output stream (out_start) are written right away, the host
+ * is only asked for a write event for what is left. errors are left for the next bsc_write to report.
+ * commands held back by the flush policy arm its timer instead.
+ */
+#define CBQ_ENQ_NOTIFY(c, out_start) do {                                           \
+    if ( (c)->watermark_cb != NULL && !(c)->above_high                              \
+      && (c)->cbqueue->used >= (c)->buf_high ) {                                    \
+        (c)->above_high = true;                                                     \
+        (c)->watermark_cb((c), true);                                               \
+    }                                                                               \
+    if (CBQ_FLUSH_HOLD(c)) {                                                        \
+        if (!(c)->flush_timer_armed) {                                              \
+            (c)->flush_timer_armed = true;                                          \
+            (c)->flush_timer_cb((c), (c)->flush_usec);                              \
+        }                                                                           \
+        break;                                                                      \
+    }                                                                               \
+    if ( (c)->eager_write && !(c)->corked && (c)->state == BSC_STATE_CONNECTED      \
+      && ( (c)->tubeq == NULL || AQ_EMPTY((c)->tubeq) )                             \
+      && (c)->outq->bytes_written == (out_start) )                                  \
+        ioq_dump((c)->outq, (c)->fd);                                               \
+    if ( (c)->buffer_fill_cb != NULL && !(c)->corked && !AQ_EMPTY((c)->outq) )      \
+        (c)->buffer_fill_cb(c);                                                     \
+} while (false)
+
+#define CBQ_ENQ_FIN(c) do {                                                         \
+    AQ_ENQ_FIN((c)->cbqueue);                                                       \
+    CBQ_ENQ_NOTIFY(c, AQ_LAST_((c)->cbqueue)->out_start);                           \
+} while (false)
 
-#define CBQ_DEQ_FIN(q) do {        \
-    if (AQ_REAR_(q)->is_allocated) \
-        free(AQ_REAR_(q)->data);   \
-    AQ_DEQ_FIN(q);                 \
+#define CBQ_DEQ_FIN(q) do {                                             \
+    if (AQ_REAR_(q)->is_allocated)                                      \
+        free(AQ_REAR_(q)->data);                                        \
+    else if (CBQ_CMD_OWNS(q, AQ_REAR_(q)->data))                        \
+        (q)->cmd_som = (char *)AQ_REAR_(q)->data + AQ_REAR_(q)->len;    \
+    AQ_DEQ_FIN(q);                                                      \
+    if (AQ_EMPTY(q))                                                    \
+        (q)->cmd_som = (q)->cmd_eom = (q)->cmd_data;                    \
 } while (false)
 
-cbq *cbq_new(size_t size);
+cbq  *cbq_new(size_t size);
+void  cbq_free(cbq *q);
+
+/** 
+* moves the nodes to a ring of size nodes. a queue with pending nodes can only grow,
+* their command info stays in place (callbacks hold pointers into it) and so does the arena,
+* commands that do not fit in it are allocated. an empty queue gets a new arena matching size.
+* 
+* @param q     the queue
+* @param size  the new number of nodes
+* 
+* @return false when out of memory or size is too small
+*/
+bool  cbq_resize(cbq *q, size_t size);
+
+/** 
+* returns a pointer to at least BSP_CMD_BUF_LEN contiguous free bytes in the command arena.
+* the space is taken only once it is committed with CBQ_CMD_COMMIT.
+* 
+* @param q  the queue
+* 
+* @return a pointer into the arena, never NULL while the queue has a free node
+*/
+char *cbq_cmd_reserve(cbq *q);
 
 #ifdef __cplusplus
     }
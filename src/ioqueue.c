@@ -36,19 +36,171 @@
  * =====================================================================================
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define _GNU_SOURCE
 #include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
 
 #include "ioqueue.h"
 
-#define IOQ_DUMP_FIN(q, n) do {                        \
-    size_t __iter;                                     \
-    for ( __iter = 0; __iter < (n); ++__iter ) {       \
-        if ( AQ_REAR_(q)->autofree )                   \
-            free(AQ_REAR_(q)->vec->iov_base);          \
-        AQ_DEQ_FIN(q);                                 \
-    }                                                  \
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* 
+ * every iovec is mirrored size nodes ahead of itself, so the used part of the ring
+ * can always be handed to writev as one array even when it wraps around.
+ */
+#define IOQ_VEC_SYNC_SIZE(size, node) ( (node)->vec[(size)] = *(node)->vec )
+#define IOQ_VEC_SYNC(q, node)         IOQ_VEC_SYNC_SIZE((q)->size, node)
+
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define IOQ_HAVE_ZEROCOPY
+#endif
+
+/* a node that was (partly) sent with MSG_ZEROCOPY must finish that way, a new one needs a free zcq slot */
+#define IOQ_ZC_WANTED(q, node)                                                  \
+    ( (node)->zerocopy                                                          \
+      || ( (q)->zc_threshold && (node)->release != NULL                         \
+           && (node)->vec->iov_len >= (q)->zc_threshold && !AQ_FULL((q)->zcq) ) )
+
+/* 
+ * the node is retired before it is released, a release callback may queue more data (even write it
+ * through an eager put, which in_release holds back until the caller is done with the queue).
+ */
+#define IOQ_DUMP_FIN(q, n) do {                                             \
+    ioq_node __node;                                                        \
+    size_t   __iter;                                                        \
+    for ( __iter = 0; __iter < (n); ++__iter ) {                            \
+        __node = *AQ_REAR_(q);                                              \
+        AQ_DEQ_FIN(q);                                                      \
+        if (__node.zerocopy)                                                \
+            ioq_zc_defer(q, &__node);                                       \
+        else if (__node.release != NULL) {                                  \
+            ++(q)->in_release;                                              \
+            __node.release(__node.data, __node.release_ctx);                \
+            --(q)->in_release;                                              \
+        }                                                                   \
+    }                                                                       \
+} while (0)
+
+#define IOQ_ZC_RELEASE(zcq) do {                                            \
+    AQ_REAR_(zcq)->release(AQ_REAR_(zcq)->data, AQ_REAR_(zcq)->release_ctx); \
+    AQ_DEQ_FIN(zcq);                                                        \
 } while (0)
 
+static void ioq_autofree(void *data, void *ctx)
+{
+    (void)ctx;
+    free(data);
+}
+
+/* the kernel may still read the node's data until the completion of the last send that used it arrives */
+static void ioq_zc_defer(ioq *q, ioq_node *node)
+{
+    AQ_FRONT_(q->zcq)->data        = node->data;
+    AQ_FRONT_(q->zcq)->release     = node->release;
+    AQ_FRONT_(q->zcq)->release_ctx = node->release_ctx;
+    AQ_FRONT_(q->zcq)->seq         = q->zc_seq - 1;
+    AQ_ENQ_FIN(q->zcq);
+}
+
+/* sends (part of) the rear node with MSG_ZEROCOPY, every send that wrote something gets the next seq */
+static ssize_t ioq_send_zc(ioq *q, int fd)
+{
+#ifdef IOQ_HAVE_ZEROCOPY
+    struct msghdr msg;
+    ssize_t       bytes_written;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = IOQ_REAR_(q);
+    msg.msg_iovlen = 1;
+
+    if ( ( bytes_written = sendmsg(fd, &msg, MSG_ZEROCOPY | ( q->used > 1 ? MSG_MORE : 0 )) ) > 0 ) {
+        AQ_REAR_(q)->zerocopy = 1;
+        ++q->zc_seq;
+        IOQ_REAR_(q)->iov_base += bytes_written;
+        IOQ_REAR_(q)->iov_len  -= bytes_written;
+        IOQ_VEC_SYNC(q, AQ_REAR_(q));
+    }
+
+    return bytes_written;
+#else
+    errno = ENOBUFS;
+    return -1;
+#endif
+}
+
+/* writes a chunk that more data follows, a socket holds back the last partial segment for it */
+static ssize_t ioq_writev_more(int fd, struct iovec *vec, size_t nodes)
+{
+    struct msghdr msg;
+    ssize_t       bytes_written;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = vec;
+    msg.msg_iovlen = nodes;
+
+    if ( ( bytes_written = sendmsg(fd, &msg, MSG_MORE) ) < 0 && errno == ENOTSOCK )
+        return writev(fd, vec, nodes);
+
+    return bytes_written;
+}
+
+/* sends (part of) a file node, the node is advanced by the bytes written */
+static ssize_t ioq_send_fd(ioq_node *node, int fd)
+{
+    size_t  len = node->vec->iov_len;
+    ssize_t bytes_written;
+
+    if (node->offset < 0) {
+#ifdef HAVE_SPLICE
+        /* the pipe holds the whole body (see bsc_put_fd), nonblocking keeps a short one from stalling the host */
+        bytes_written = splice(node->fd, NULL, fd, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK);
+#else
+        /* bytes read from a pipe can not be pushed back after a short write */
+        errno = EINVAL;
+        bytes_written = -1;
+#endif
+    }
+    else {
+#ifdef HAVE_SENDFILE
+        bytes_written = sendfile(fd, node->fd, &(node->offset), len);
+#else
+        char buf[16384];
+        if ( ( bytes_written = pread(node->fd, buf, len < sizeof(buf) ? len : sizeof(buf), node->offset) ) > 0
+          && ( bytes_written = write(fd, buf, bytes_written) ) > 0 )
+            node->offset += bytes_written;
+#endif
+    }
+
+    /* the source ended before len bytes were sent */
+    if (bytes_written == 0 && len > 0) {
+        errno = EIO;
+        return -1;
+    }
+
+    if (bytes_written > 0)
+        node->vec->iov_len -= bytes_written;
+
+    return bytes_written;
+}
+
 ioq *ioq_new(size_t size)
 {
     register size_t i;
@@ -61,7 +213,7 @@ ioq *ioq_new(size_t size)
     if ( ( q->nodes = (ioq_node *)malloc( sizeof(ioq_node) * size ) ) == NULL )
         goto nodes_malloc_error;
 
-    if ( ( vec = (struct iovec *)malloc(sizeof(struct iovec) * size) ) == NULL )
+    if ( ( vec = (struct iovec *)malloc(sizeof(struct iovec) * size * 2) ) == NULL )
         goto vec_malloc_error;
 
     for (i = 0; i < size; ++i)
@@ -70,6 +222,12 @@ ioq *ioq_new(size_t size)
     q->size = size;
     q->rear = q->front = 0;
     q->used = 0;
+    q->bytes_queued = q->bytes_written = 0;
+    q->zc_threshold = 0;
+    q->zcq = NULL;
+    q->zc_seq = 0;
+    q->zc_completed = q->zc_copied = 0;
+    q->in_release = 0;
 
     return q;
 
@@ -80,12 +238,68 @@ nodes_malloc_error:
     return NULL;
 }
 
-void ioq_enq_(ioq *q, void *data, ssize_t data_len, int autofree)
+int ioq_resize(ioq *q, size_t size)
+{
+    register size_t i;
+    struct iovec *vec = NULL;
+    ioq_node *nodes = NULL;
+
+    if (size < q->used)
+        return 0;
+
+    if ( ( nodes = (ioq_node *)malloc( sizeof(ioq_node) * size ) ) == NULL )
+        return 0;
+
+    if ( ( vec = (struct iovec *)malloc(sizeof(struct iovec) * size * 2) ) == NULL ) {
+        free(nodes);
+        return 0;
+    }
+
+    /* the pending nodes move to the start of the new ring */
+    for (i = 0; i < size; ++i) {
+        if (i < q->used) {
+            vec[i]   = *AQ_NTH_(q, i)->vec;
+            nodes[i] = *AQ_NTH_(q, i);
+        }
+        nodes[i].vec = vec+i;
+        if (i < q->used)
+            IOQ_VEC_SYNC_SIZE(size, nodes+i);
+    }
+
+    free(q->nodes[0].vec);
+    free(q->nodes);
+    q->nodes = nodes;
+    q->size  = size;
+    q->rear  = 0;
+    q->front = q->used % size;
+
+    return 1;
+}
+
+void ioq_enq_release_(ioq *q, void *data, ssize_t data_len, ioq_release_cb release, void *ctx)
 {
     AQ_FRONT_(q)->vec->iov_base = data;
     AQ_FRONT_(q)->vec->iov_len  = data_len;
-    AQ_FRONT_(q)->autofree      = autofree;
+    AQ_FRONT_(q)->data          = data;
+    AQ_FRONT_(q)->fd            = -1;
+    AQ_FRONT_(q)->release       = release;
+    AQ_FRONT_(q)->release_ctx   = ctx;
+    AQ_FRONT_(q)->zerocopy      = 0;
+    IOQ_VEC_SYNC(q, AQ_FRONT_(q));
     AQ_ENQ_FIN(q);
+    q->bytes_queued += data_len;
+}
+
+void ioq_enq_fd_(ioq *q, int fd, off_t offset, size_t len, ioq_release_cb release, void *ctx)
+{
+    ioq_enq_release_(q, NULL, len, release, ctx);
+    AQ_LAST_(q)->fd     = fd;
+    AQ_LAST_(q)->offset = offset;
+}
+
+void ioq_enq_(ioq *q, void *data, ssize_t data_len, int autofree)
+{
+    ioq_enq_release_(q, data, data_len, autofree ? ioq_autofree : NULL, NULL);
 }
 
 int ioq_enq(ioq *q, void *data, ssize_t data_len, int autofree)
@@ -96,38 +310,215 @@ int ioq_enq(ioq *q, void *data, ssize_t data_len, int autofree)
     return 1;
 }
 
+/* 
+ * extends the newest node when data directly follows it in memory, it is never freed.
+ * a release callback gets a node of its own, the newest may be part of the write being retired.
+ */
+void ioq_enq_append_(ioq *q, void *data, ssize_t data_len)
+{
+    if ( !AQ_EMPTY(q) && !q->in_release && AQ_LAST_(q)->release == NULL && AQ_LAST_(q)->fd < 0
+      && (char *)AQ_LAST_(q)->vec->iov_base + AQ_LAST_(q)->vec->iov_len == (char *)data ) {
+        AQ_LAST_(q)->vec->iov_len += data_len;
+        IOQ_VEC_SYNC(q, AQ_LAST_(q));
+        q->bytes_queued += data_len;
+    }
+    else
+        ioq_enq_(q, data, data_len, 0);
+}
+
+void ioq_truncate_last(ioq *q, size_t len)
+{
+    AQ_LAST_(q)->vec->iov_len = len;
+    IOQ_VEC_SYNC(q, AQ_LAST_(q));
+}
+
+void ioq_clear(ioq *q)
+{
+    q->rear = q->front = 0;
+    q->used = 0;
+    q->bytes_queued = q->bytes_written;
+
+    if (q->zcq != NULL)
+        while ( !AQ_EMPTY(q->zcq) )
+            IOQ_ZC_RELEASE(q->zcq);
+    q->zc_seq = 0;
+}
+
+int ioq_zerocopy(ioq *q, size_t threshold)
+{
+#ifdef IOQ_HAVE_ZEROCOPY
+    if (threshold && q->zcq == NULL) {
+        if ( ( q->zcq = (struct _ioq_zcq *)malloc(sizeof(struct _ioq_zcq)) ) == NULL )
+            return 0;
+        if ( ( q->zcq->nodes = (struct _ioq_zc_node *)malloc(sizeof(struct _ioq_zc_node) * q->size) ) == NULL ) {
+            free(q->zcq);
+            q->zcq = NULL;
+            return 0;
+        }
+        q->zcq->size = q->size;
+        q->zcq->rear = q->zcq->front = 0;
+        q->zcq->used = 0;
+    }
+    q->zc_threshold = threshold;
+    return 1;
+#else
+    q->zc_threshold = 0;
+    return threshold == 0;
+#endif
+}
+
+ssize_t ioq_zerocopy_reap(ioq *q, int fd)
+{
+#ifdef IOQ_HAVE_ZEROCOPY
+    char            control[128];
+    struct msghdr   msg;
+    struct cmsghdr *cm = NULL;
+    struct sock_extended_err *serr = NULL;
+    ssize_t         released = 0;
+
+    if (q->zcq == NULL)
+        return 0;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || released ? released : -1;
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if ( !( cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR )
+              && !( cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR ) )
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0)
+                continue;
+
+            /* sends ee_info to ee_data (inclusive) are done, the kernel copied them when it could not pin the pages */
+            q->zc_completed += serr->ee_data - serr->ee_info + 1;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                q->zc_copied += serr->ee_data - serr->ee_info + 1;
+
+            while ( !AQ_EMPTY(q->zcq) && (int32_t)(AQ_REAR_(q->zcq)->seq - serr->ee_data) <= 0 ) {
+                IOQ_ZC_RELEASE(q->zcq);
+                ++released;
+            }
+        }
+    }
+#else
+    return 0;
+#endif
+}
+
 void ioq_free(ioq *q)
 {
-    IOQ_DUMP_FIN(q, q->used);
+    while ( !AQ_EMPTY(q) )
+        IOQ_DUMP_FIN(q, 1);
+    if (q->zcq != NULL) {
+        while ( !AQ_EMPTY(q->zcq) )
+            IOQ_ZC_RELEASE(q->zcq);
+        free(q->zcq->nodes);
+        free(q->zcq);
+    }
+    free(q->nodes[0].vec);
     free(q->nodes);
     free(q);
 }
 
+/* the rear node and the memory nodes that follow it, up to the next file or zerocopy node */
+static size_t ioq_gather_(ioq *q)
+{
+    size_t nodes, max_nodes = q->used < IOV_MAX ? q->used : IOV_MAX;
+
+    for (nodes = 1; nodes < max_nodes && AQ_NTH_(q, nodes)->fd < 0 && !IOQ_ZC_WANTED(q, AQ_NTH_(q, nodes)); ++nodes) ;
+
+    return nodes;
+}
+
 ssize_t ioq_dump(ioq *q, int fd)
 {
-    size_t  bytes_expected = 0, nodes_ready = IOQ_NODES_READY(q), i;
-    ssize_t bytes_written, nodes_written  = 0;
-
-    for (i = 0; i < nodes_ready; ++i)
-        bytes_expected += IOQ_PEEK_POS(q,i)->iov_len;
-
-    if ( ( bytes_written = writev(fd, IOQ_REAR_(q), nodes_ready) ) < bytes_expected )
-        switch (bytes_written) {
-            case -1:
-                return -1;
-            default:
-                while ( ( bytes_written -= IOQ_REAR_(q)->iov_len ) > 0 ) {
-                    IOQ_DUMP_FIN(q, 1);
-                    ++nodes_written;
-                }
-                if ( bytes_written < 0 ) {
-                    IOQ_REAR_(q)->iov_base += IOQ_REAR_(q)->iov_len + bytes_written;
-                    IOQ_REAR_(q)->iov_len   = -bytes_written;
-                }
+    size_t  nodes, i;
+    ssize_t bytes_written, nodes_written = 0;
+
+    /* the nodes of a write that is being retired were already sent, the outer dump writes the rest */
+    if (q->in_release)
+        return 0;
+
+    while ( !AQ_EMPTY(q) ) {
+        if (AQ_REAR_(q)->fd >= 0) {
+            if ( ( bytes_written = ioq_send_fd(AQ_REAR_(q), fd) ) < 0 )
+                return nodes_written ? nodes_written : -1;
+
+            q->bytes_written += bytes_written;
+            IOQ_VEC_SYNC(q, AQ_REAR_(q));
+
+            /* a short send means the socket buffer is full */
+            if (IOQ_REAR_(q)->iov_len > 0)
                 return nodes_written;
+
+            IOQ_DUMP_FIN(q, 1);
+            ++nodes_written;
+            continue;
         }
-    else {
-        IOQ_DUMP_FIN(q, nodes_ready);
-        return nodes_ready;
+
+        if ( IOQ_ZC_WANTED(q, AQ_REAR_(q)) ) {
+            if ( ( bytes_written = ioq_send_zc(q, fd) ) >= 0 ) {
+                q->bytes_written += bytes_written;
+
+                if (IOQ_REAR_(q)->iov_len > 0)
+                    return nodes_written;
+
+                IOQ_DUMP_FIN(q, 1);
+                ++nodes_written;
+                continue;
+            }
+            /* out of option memory for pinned pages, this node is copied */
+            if (errno != ENOBUFS)
+                return nodes_written ? nodes_written : -1;
+        }
+
+        nodes = ioq_gather_(q);
+        bytes_written = nodes < q->used ? ioq_writev_more(fd, IOQ_REAR_(q), nodes) : writev(fd, IOQ_REAR_(q), nodes);
+        if (bytes_written < 0)
+            return nodes_written ? nodes_written : -1;
+
+        i = ioq_written(q, bytes_written);
+        nodes_written += i;
+
+        /* a short write means the socket buffer is full */
+        if (i < nodes)
+            return nodes_written;
+    }
+
+    return nodes_written;
+}
+
+size_t ioq_gather(ioq *q)
+{
+    if ( AQ_EMPTY(q) || AQ_REAR_(q)->fd >= 0 || IOQ_ZC_WANTED(q, AQ_REAR_(q)) )
+        return 0;
+
+    return ioq_gather_(q);
+}
+
+size_t ioq_written(ioq *q, size_t bytes)
+{
+    size_t nodes = 0;
+
+    q->bytes_written += bytes;
+
+    for ( ; !AQ_EMPTY(q) && bytes >= IOQ_REAR_(q)->iov_len; ++nodes) {
+        bytes -= IOQ_REAR_(q)->iov_len;
+        IOQ_DUMP_FIN(q, 1);
+    }
+
+    if (bytes) {
+        IOQ_REAR_(q)->iov_base += bytes;
+        IOQ_REAR_(q)->iov_len  -= bytes;
+        IOQ_VEC_SYNC(q, AQ_REAR_(q));
     }
+
+    return nodes;
 }
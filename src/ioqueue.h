@@ -40,28 +40,106 @@
 #ifndef _IOQUEUE_H
 #define _IOQUEUE_H
 
+#include <stdint.h>
+#include <sys/types.h>
 #include <sys/uio.h>
 #include <arrayqueue.h>
 
+typedef void (*ioq_release_cb)(void *data, void *ctx);
+
+/* a node with a file descriptor (fd >= 0) sends vec->iov_len bytes of the file instead of memory */
 struct _ioq_node {
-    struct iovec *vec;
-    int    autofree;
+    struct iovec  *vec;
+    void          *data;
+    int            fd;
+    off_t          offset;
+    ioq_release_cb release;
+    void          *release_ctx;
+    int            zerocopy;
+};
+
+/* a node sent with MSG_ZEROCOPY, its data is released once the kernel completed send number seq */
+struct _ioq_zc_node {
+    void          *data;
+    ioq_release_cb release;
+    void          *release_ctx;
+    uint32_t       seq;
 };
 
-AQ_DEFINE_STRUCT(_ioq, struct _ioq_node);
+AQ_DEFINE_STRUCT(_ioq_zcq, struct _ioq_zc_node);
+
+/* bytes_queued and bytes_written count the whole output stream since the queue was created */
+struct _ioq {
+    AQ_STRUCT_FIELDS(struct _ioq_node)
+    uint64_t bytes_queued;
+    uint64_t bytes_written;
+    /* zerocopy sends (zc_threshold > 0), zc_completed counts the sends the kernel reported done */
+    size_t   zc_threshold;
+    struct _ioq_zcq *zcq;
+    uint32_t zc_seq;
+    uint64_t zc_completed;
+    uint64_t zc_copied;
+    unsigned in_release;    /* a written node's release callback is running */
+};
 
 typedef struct _ioq ioq;
 typedef struct _ioq_node ioq_node;
 
 #define IOQ_NODES_READY(q)   ((q)->used ? ( (q)->front <= (q)->rear ? (q)->size - (q)->rear : (q)->used ) : 0)
-#define IOQ_PEEK_POS(q, i)   ((AQ_REAR_(q)+i)->vec)
+#define IOQ_PEEK_POS(q, i)   (AQ_NTH_(q, i)->vec)
 #define IOQ_REAR_(q)         IOQ_PEEK_POS(q,0)
 #define IOQ_REAR(q)          (AQ_EMPTY(q) ? NULL : IOQ_REAR_(q))
 
 void    ioq_enq_(ioq *q, void *data, ssize_t data_len, int autofree);
 int     ioq_enq(ioq *q, void *data, ssize_t data_len, int autofree);
+void    ioq_enq_append_(ioq *q, void *data, ssize_t data_len);
+
+/* rolls the newest node back to len bytes (of an append), bytes_queued is left to the caller */
+void    ioq_truncate_last(ioq *q, size_t len);
+
+/* release is called with data and ctx once the node was written (or the queue is freed) */
+void    ioq_enq_release_(ioq *q, void *data, ssize_t data_len, ioq_release_cb release, void *ctx);
+
+/* 
+ * queues len bytes of fd, sent with sendfile from offset or spliced from the current position when offset < 0
+ * (a pipe, which must already hold all len bytes). release is called with NULL data.
+ */
+void    ioq_enq_fd_(ioq *q, int fd, off_t offset, size_t len, ioq_release_cb release, void *ctx);
+
+/* 
+ * drops all nodes without releasing them, their data is owned by the caller again.
+ * nodes still waiting for a zerocopy completion are released (the socket was replaced).
+ */
+void    ioq_clear(ioq *q);
+
+/* 
+ * sends memory nodes of at least threshold bytes that have a release callback with MSG_ZEROCOPY,
+ * 0 turns it off. the socket must have SO_ZEROCOPY set. returns 0 when it is not supported.
+ */
+int     ioq_zerocopy(ioq *q, size_t threshold);
+
+/* reads the zerocopy completions of fd's error queue and releases the finished nodes */
+ssize_t ioq_zerocopy_reap(ioq *q, int fd);
+
+/* 
+ * writes until the queue is empty or the fd would block, returns the number of nodes completed.
+ * a chunk that is followed by more nodes is sent with MSG_MORE. from inside a release callback
+ * nothing is written (0 is returned), the dump or ioq_written that released the node continues.
+ */
 ssize_t ioq_dump(ioq *q, int fd);
+
+/* 
+ * the number of memory nodes from the rear that go out in a single writev of IOQ_REAR_(q),
+ * 0 when the rear node is a file or zerocopy node (those are left for ioq_dump).
+ */
+size_t  ioq_gather(ioq *q);
+
+/* completes the first bytes of the queue, written outside of ioq_dump. returns the number of nodes completed */
+size_t  ioq_written(ioq *q, size_t bytes);
 ioq    *ioq_new(size_t size);
+
+/* moves the nodes to a ring of size nodes (at least q->used), returns 0 when out of memory */
+int     ioq_resize(ioq *q, size_t size);
 void    ioq_free(ioq *q);
 
 #endif /* _IOQUEUE_H */
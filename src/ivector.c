@@ -8,6 +8,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "ivector.h"
 
 ivector *ivector_new(size_t init_size)
@@ -17,7 +18,7 @@ ivector *ivector_new(size_t init_size)
     if ( ( vec = (ivector *)malloc(sizeof(ivector) ) ) == NULL )
         return NULL;
 
-    vec->data = NULL;
+    vec->data = vec->spare = NULL;
 
     if ( ( vec->data = (char *)malloc( sizeof(char) * init_size ) ) == NULL ) {
         free(vec);
@@ -26,6 +27,7 @@ ivector *ivector_new(size_t init_size)
 
     vec->som = vec->eom = vec->data;
     vec->size           = init_size;
+    vec->spare_size     = 0;
 
     return vec;
 }
@@ -33,6 +35,7 @@ ivector *ivector_new(size_t init_size)
 void ivector_free(ivector *vec)
 {
     free(vec->data);
+    free(vec->spare);
     free(vec);
 }
 
@@ -50,3 +53,78 @@ bool ivector_expand(ivector *vec)
 
     return true;
 }
+
+/* makes room for len bytes from som on with a single reallocation */
+bool ivector_reserve(ivector *vec, size_t len)
+{
+    char  *realloc_data = NULL;
+    size_t size         = vec->som - vec->data + len;
+
+    if (size <= vec->size)
+        return true;
+
+    if ( ( realloc_data = (char *)realloc( vec->data, sizeof(char) * size ) ) == NULL )
+        return false;
+
+    vec->som  = vec->som - vec->data + realloc_data;
+    vec->eom  = vec->eom - vec->data + realloc_data;
+    vec->data = realloc_data;
+    vec->size = size;
+
+    return true;
+}
+
+/* moves the pending bytes (som to eom) to the front, reclaiming what was consumed before them */
+void ivector_compact(ivector *vec)
+{
+    memmove(vec->data, vec->som, vec->eom - vec->som);
+    vec->eom = vec->data + ( vec->eom - vec->som );
+    vec->som = vec->data;
+}
+
+/* 
+ * an empty buffer is replaced by one of size bytes, allocating before freeing makes sure
+ * the peak buffer is released (a shrinking realloc may keep it in place).
+ */
+bool ivector_shrink(ivector *vec, size_t size)
+{
+    char *data = NULL;
+
+    if ( vec->som != vec->eom || vec->spare != NULL )
+        return false;
+
+    if (size >= vec->size)
+        return true;
+
+    if ( ( data = (char *)malloc( sizeof(char) * size ) ) == NULL )
+        return false;
+
+    free(vec->data);
+    vec->data = vec->som = vec->eom = data;
+    vec->size = size;
+
+    return true;
+}
+
+/* 
+ * the buffer is handed over as is, the spare that replaces it is allocated up front so swapping can not fail.
+ * it only has to hold what is moved to it, the vector grows again as it fills up.
+ */
+char *ivector_take(ivector *vec, size_t spare_size)
+{
+    if ( vec->spare != NULL || ( vec->spare = (char *)malloc( sizeof(char) * spare_size ) ) == NULL )
+        return NULL;
+
+    vec->spare_size = spare_size;
+
+    return vec->data;
+}
+
+/* continues in the spare buffer with the len bytes at tail that were not processed yet (at most spare_size) */
+void ivector_swap(ivector *vec, const char *tail, size_t len)
+{
+    memcpy(vec->spare, tail, len);
+    vec->data  = vec->som = vec->eom = vec->spare;
+    vec->size  = vec->spare_size;
+    vec->spare = NULL;
+}
@@ -18,6 +18,8 @@ struct _ivector {
     char  *som;
     char  *eom;
     size_t size;
+    char  *spare;   /* replaces data once it was taken */
+    size_t spare_size;
 };
 
 typedef struct _ivector ivector;
@@ -25,5 +27,10 @@ typedef struct _ivector ivector;
 ivector *ivector_new(size_t init_size);
 void     ivector_free(ivector *vec);
 bool     ivector_expand(ivector *vec);
+bool     ivector_reserve(ivector *vec, size_t len);
+void     ivector_compact(ivector *vec);
+bool     ivector_shrink(ivector *vec, size_t size);
+char    *ivector_take(ivector *vec, size_t spare_size);
+void     ivector_swap(ivector *vec, const char *tail, size_t len);
 
 #endif /* IVECTOR_H */
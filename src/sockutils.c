@@ -44,6 +44,8 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 
 #include "sockutils.h"
@@ -121,6 +123,56 @@ int unset_sock_flags(int sock, int unset_flags, char *errorstr)
     return 1;
 }
 
+/* ================================================================================
+ * socket options
+ * ================================================================================ */
+int set_zerocopy(int sock, char *errorstr)
+{
+#ifdef SO_ZEROCOPY
+    int one = 1;
+
+    if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        sperror("SO_ZEROCOPY");
+        return 0;
+    }
+    return 1;
+#else
+    errno = ENOPROTOOPT;
+    sperror("SO_ZEROCOPY");
+    return 0;
+#endif
+}
+
+int set_cork(int sock, int on, char *errorstr)
+{
+#ifdef TCP_CORK
+    if (setsockopt(sock, IPPROTO_TCP, TCP_CORK, &on, sizeof(on)) < 0) {
+        sperror("TCP_CORK");
+        return 0;
+    }
+    return 1;
+#else
+    errno = ENOPROTOOPT;
+    sperror("TCP_CORK");
+    return 0;
+#endif
+}
+
+int set_busy_poll(int sock, int usec, char *errorstr)
+{
+#ifdef SO_BUSY_POLL
+    if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+        sperror("SO_BUSY_POLL");
+        return 0;
+    }
+    return 1;
+#else
+    errno = ENOPROTOOPT;
+    sperror("SO_BUSY_POLL");
+    return 0;
+#endif
+}
+
 /* ================================================================================
  * addrinfo
  * ================================================================================ */
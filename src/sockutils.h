@@ -76,6 +76,39 @@ int set_sock_flags(int sock, int set_flags, char *errorstr);
 */
 int unset_sock_flags(int sock, int unset_flags, char *errorstr);
 
+/** 
+* allows MSG_ZEROCOPY sends on sock (SO_ZEROCOPY).
+* 
+* @param sock      the socket to set the option on
+* @param errorstr  a string to store the error in
+* 
+* @return          1 on success 0 on failure
+*/
+int set_zerocopy(int sock, char *errorstr);
+
+/** 
+* holds back partial frames on a tcp socket (TCP_CORK), uncorking sends them.
+* 
+* @param sock      the socket to set the option on
+* @param on        1 to cork 0 to uncork
+* @param errorstr  a string to store the error in
+* 
+* @return          1 on success 0 on failure
+*/
+int set_cork(int sock, int on, char *errorstr);
+
+/** 
+* lets blocking reads and polls busy wait on the device queue for up to usec microseconds (SO_BUSY_POLL).
+* raising it above net.core.busy_read requires CAP_NET_ADMIN.
+* 
+* @param sock      the socket to set the option on
+* @param usec      the busy poll time, 0 to turn it off
+* @param errorstr  a string to store the error in
+* 
+* @return          1 on success 0 on failure
+*/
+int set_busy_poll(int sock, int usec, char *errorstr);
+
 /** 
 * creates a tcp socket listening on bind_addr:port
 * 
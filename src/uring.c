@@ -0,0 +1,240 @@
+/**
+ * =====================================================================================
+ * @file     uring.c
+ * @brief    io_uring setup, submission and completion through the raw system calls
+ * =====================================================================================
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#include "uring.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define URING_SUPPORTED
+#endif
+
+#ifdef URING_SUPPORTED
+
+/* the kernel reads the submission tail and writes the completion tail concurrently */
+#define URING_LOAD(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define URING_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+uring *uring_new(unsigned entries)
+{
+    uring *ring = NULL;
+    struct io_uring_params params;
+    int    error;
+
+    if ( ( ring = (uring *)malloc(sizeof(uring)) ) == NULL )
+        return NULL;
+
+    memset(&params, 0, sizeof(params));
+    if ( ( ring->fd = syscall(__NR_io_uring_setup, entries, &params) ) < 0 )
+        goto setup_err;
+
+    /* a writev whose iovecs are gone by the time the kernel gets to it would need them kept around */
+    if ( !(params.features & IORING_FEAT_SUBMIT_STABLE) ) {
+        errno = EOPNOTSUPP;
+        goto features_err;
+    }
+
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_len    = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if ( ( ring->sq_ring = mmap(NULL, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ring->fd, IORING_OFF_SQ_RING) ) == MAP_FAILED )
+        goto features_err;
+    if ( ( ring->cq_ring = mmap(NULL, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ring->fd, IORING_OFF_CQ_RING) ) == MAP_FAILED )
+        goto cq_mmap_err;
+    if ( ( ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES) ) == MAP_FAILED )
+        goto sqes_mmap_err;
+
+    ring->sq_head    = (unsigned *)( (char *)ring->sq_ring + params.sq_off.head );
+    ring->sq_tail    = (unsigned *)( (char *)ring->sq_ring + params.sq_off.tail );
+    ring->sq_mask    = (unsigned *)( (char *)ring->sq_ring + params.sq_off.ring_mask );
+    ring->sq_array   = (unsigned *)( (char *)ring->sq_ring + params.sq_off.array );
+    ring->cq_head    = (unsigned *)( (char *)ring->cq_ring + params.cq_off.head );
+    ring->cq_tail    = (unsigned *)( (char *)ring->cq_ring + params.cq_off.tail );
+    ring->cq_mask    = (unsigned *)( (char *)ring->cq_ring + params.cq_off.ring_mask );
+    ring->cqes       = (struct io_uring_cqe *)( (char *)ring->cq_ring + params.cq_off.cqes );
+    ring->cq_entries = params.cq_entries;
+    ring->sq_pending = 0;
+
+    return ring;
+
+sqes_mmap_err:
+    munmap(ring->cq_ring, ring->cq_ring_len);
+cq_mmap_err:
+    munmap(ring->sq_ring, ring->sq_ring_len);
+features_err:
+    error = errno;
+    close(ring->fd);
+    errno = error;
+setup_err:
+    free(ring);
+    return NULL;
+}
+
+void uring_free(uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_len);
+    munmap(ring->cq_ring, ring->cq_ring_len);
+    munmap(ring->sq_ring, ring->sq_ring_len);
+    close(ring->fd);
+    free(ring);
+}
+
+/* the next free submission entry (zeroed), a full queue is submitted to make room */
+static struct io_uring_sqe *uring_sqe(uring *ring)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *ring->sq_tail;
+
+    if ( tail - URING_LOAD(ring->sq_head) > *ring->sq_mask ) {
+        if (uring_enter(ring, 0) < 0)
+            return NULL;
+        if ( tail - URING_LOAD(ring->sq_head) > *ring->sq_mask ) {
+            errno = EBUSY;
+            return NULL;
+        }
+    }
+
+    sqe = ring->sqes + ( tail & *ring->sq_mask );
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+
+    return sqe;
+}
+
+/* hands the entry returned by uring_sqe over to the kernel's side of the queue */
+static void uring_sqe_fin(uring *ring)
+{
+    URING_STORE(ring->sq_tail, *ring->sq_tail + 1);
+    ++ring->sq_pending;
+}
+
+static bool uring_rw(uring *ring, int op, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ( ( sqe = uring_sqe(ring) ) == NULL )
+        return false;
+
+    sqe->opcode    = op;
+    sqe->fd        = fd;
+    sqe->addr      = (uint64_t)(uintptr_t)iov;
+    sqe->len       = iovcnt;
+    sqe->user_data = data;
+    uring_sqe_fin(ring);
+
+    return true;
+}
+
+bool uring_readv(uring *ring, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t data)
+{
+    return uring_rw(ring, IORING_OP_READV, fd, iov, iovcnt, data);
+}
+
+bool uring_writev(uring *ring, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t data)
+{
+    return uring_rw(ring, IORING_OP_WRITEV, fd, iov, iovcnt, data);
+}
+
+bool uring_cancel(uring *ring, uint64_t data)
+{
+    struct io_uring_sqe *sqe;
+
+    if ( ( sqe = uring_sqe(ring) ) == NULL )
+        return false;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd     = -1;
+    sqe->addr   = data;
+    uring_sqe_fin(ring);
+
+    return true;
+}
+
+bool uring_timeout(uring *ring, long msec)
+{
+    struct io_uring_sqe *sqe;
+
+    if ( ( sqe = uring_sqe(ring) ) == NULL )
+        return false;
+
+    /* read by the kernel when the entry is submitted */
+    ring->timeout[0] = msec / 1000;
+    ring->timeout[1] = ( msec % 1000 ) * 1000000;
+
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd     = -1;
+    sqe->addr   = (uint64_t)(uintptr_t)ring->timeout;
+    sqe->len    = 1;
+    /* a pure timeout would outlive a wait ended by a completion and cut the wait of a later enter short */
+    sqe->off    = 1;
+    uring_sqe_fin(ring);
+
+    return true;
+}
+
+int uring_enter(uring *ring, unsigned min_complete)
+{
+    int submitted;
+
+    if ( ( submitted = syscall(__NR_io_uring_enter, ring->fd, ring->sq_pending, min_complete,
+                               min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0) ) < 0 )
+        return -1;
+
+    ring->sq_pending -= submitted;
+    return submitted;
+}
+
+bool uring_reap(uring *ring, uint64_t *data, int *res)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head = *ring->cq_head;
+
+    if ( head == URING_LOAD(ring->cq_tail) )
+        return false;
+
+    cqe   = ring->cqes + ( head & *ring->cq_mask );
+    *data = cqe->user_data;
+    *res  = cqe->res;
+    URING_STORE(ring->cq_head, head + 1);
+
+    return true;
+}
+
+#else
+
+uring *uring_new(unsigned entries)
+{
+    errno = ENOSYS;
+    return NULL;
+}
+
+void uring_free(uring *ring) { }
+
+bool uring_readv(uring *ring, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t data) { return false; }
+bool uring_writev(uring *ring, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t data) { return false; }
+bool uring_cancel(uring *ring, uint64_t data) { return false; }
+bool uring_timeout(uring *ring, long msec) { return false; }
+int  uring_enter(uring *ring, unsigned min_complete) { errno = ENOSYS; return -1; }
+bool uring_reap(uring *ring, uint64_t *data, int *res) { return false; }
+
+#endif
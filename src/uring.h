@@ -0,0 +1,69 @@
+/**
+ * =====================================================================================
+ * @file     uring.h
+ * @brief    header file for uring.c - a minimal io_uring (raw system calls, no liburing)
+ * =====================================================================================
+ */
+
+#ifndef _URING_H
+#define _URING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+/* the ring layout is only known to uring.c, everything else goes through the functions below */
+struct _uring {
+    int       fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned  sq_pending;           /* prepared entries the kernel was not told about yet */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    unsigned  cq_entries;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void     *sq_ring;
+    void     *cq_ring;
+    size_t    sq_ring_len;
+    size_t    cq_ring_len;
+    size_t    sqes_len;
+    int64_t   timeout[2];           /* a struct __kernel_timespec for uring_timeout */
+};
+
+typedef struct _uring uring;
+
+/* 
+ * sets up a ring with entries submission entries. returns NULL with errno set when out of memory
+ * or when io_uring is missing (ENOSYS) or too old to keep the iovecs of a submission (EOPNOTSUPP).
+ */
+uring *uring_new(unsigned entries);
+void   uring_free(uring *ring);
+
+/* 
+ * prepare a readv, a writev or a cancel of the request with data. a full submission queue is
+ * submitted first, false means even that failed (errno is set). iovecs are copied on submission.
+ */
+bool   uring_readv(uring *ring, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t data);
+bool   uring_writev(uring *ring, int fd, const struct iovec *iov, unsigned iovcnt, uint64_t data);
+bool   uring_cancel(uring *ring, uint64_t data);
+
+/* 
+ * a timeout (completing with data 0) that expires after msec milliseconds or at the next completion,
+ * whichever comes first. it bounds a wait, it is not a timer.
+ */
+bool   uring_timeout(uring *ring, long msec);
+
+/* 
+ * submits the prepared entries and waits for at least min_complete completions.
+ * returns the number of entries submitted, -1 with errno set on error (EINTR included).
+ */
+int    uring_enter(uring *ring, unsigned min_complete);
+
+/* pops the next completion, false when there is none */
+bool   uring_reap(uring *ring, uint64_t *data, int *res);
+
+#endif /* _URING_H */
@@ -0,0 +1,85 @@
+/**
+ * =====================================================================================
+ * @file     bench_framing.c
+ * @brief    microbenchmark for framing pipelined responses (memchr per line vs bsp_scan_lf)
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "beanstalkproto.h"
+
+/* a recv worth of 16 byte responses */
+#define RESPONSE     "INSERTED 12345\r\n"
+#define RESPONSE_LEN ( sizeof(RESPONSE) - 1 )
+#define RESPONSES    4096
+#define ROUNDS       2000
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* frames the chunk the way read_responses used to, one memchr per response */
+static size_t frame_memchr(const char *data, size_t len)
+{
+    const char *p = data, *end = data + len, *eom;
+    size_t      lines = 0;
+
+    while ( p < end && ( eom = (const char *)memchr(p, '\n', end - p) ) != NULL ) {
+        p = eom + 1;
+        ++lines;
+    }
+    return lines;
+}
+
+/* frames the chunk from a batch index of its line feeds */
+static size_t frame_scan(const char *data, size_t len)
+{
+    size_t pos[BSP_LF_BATCH], start = 0, scanned, count, lines = 0;
+
+    while (start < len) {
+        count = bsp_scan_lf(data + start, len - start, pos, BSP_LF_BATCH, &scanned);
+        lines += count;
+        start += scanned;
+    }
+    return lines;
+}
+
+int main()
+{
+    size_t len = RESPONSE_LEN * RESPONSES, i, lines = 0;
+    char  *data;
+    double t, memchr_t, scan_t;
+
+    if ( ( data = (char *)malloc(len) ) == NULL )
+        return EXIT_FAILURE;
+    for (i = 0; i < RESPONSES; ++i)
+        memcpy(data + i * RESPONSE_LEN, RESPONSE, RESPONSE_LEN);
+
+    t = now();
+    for (i = 0; i < ROUNDS; ++i)
+        lines += frame_memchr(data, len);
+    memchr_t = now() - t;
+
+    t = now();
+    for (i = 0; i < ROUNDS; ++i)
+        lines += frame_scan(data, len);
+    scan_t = now() - t;
+
+    if (lines != 2 * (size_t)ROUNDS * RESPONSES) {
+        fprintf(stderr, "framing mismatch\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("memchr:      %8.2f ns/response\n", memchr_t * 1e9 / ROUNDS / RESPONSES);
+    printf("bsp_scan_lf: %8.2f ns/response (%.2fx)\n", scan_t * 1e9 / ROUNDS / RESPONSES, memchr_t / scan_t);
+
+    free(data);
+    return EXIT_SUCCESS;
+}
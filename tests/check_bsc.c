@@ -40,8 +40,16 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
 #include <sys/select.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
 #include "beanstalkclient.h"
+#include "cbq.h"
+#include "ivector.h"
 
 char *host = "localhost", *port = BSC_DEFAULT_PORT;
 char *reconnect_test_port = "16666";
@@ -75,6 +83,7 @@ int client_poll(bsc *client, fd_set *readset, fd_set *writeset)
         if (FD_ISSET(client->fd, writeset))
             bsc_write(client);
     }
+    return EXIT_SUCCESS;
 }
 
 /* generic error handler - fail on error */
@@ -306,8 +315,9 @@ static void reconnect(bsc *client, bsc_error_t error)
     }
     else if (error == BSC_ERROR_SOCKET) {
         if ( bsc_reconnect(client, errorstr) ) {
-            fail_if( client->outq->used != 9, 
-                "after reconnect: nodes_used : %d/%d", client->outq->used, 9);
+            /* [reserve x3 + put hdr] [body] [CRLF + put hdr] [body] [CRLF] */
+            fail_if( client->outq->used != 5, 
+                "after reconnect: nodes_used : %d/%d", client->outq->used, 5);
 
             printf("reconnect successful\n", client);
 
@@ -415,6 +425,11 @@ void tube_test_watch_cb(bsc *client, struct bsc_watch_info *info)
     }
 }
 
+#define IOV_EQ(iov, str) ( (iov)->iov_len == strlen(str) && memcmp((iov)->iov_base, (str), (iov)->iov_len) == 0 )
+
+/* the restored tube commands are coalesced into a single iovec */
+#define TT_TUBE_CMDS "use baba1\r\nwatch baba1\r\nwatch baba2\r\nignore default\r\n"
+
 static void tt_reconnect(bsc *client, bsc_error_t error)
 {
     char errorstr[BSC_ERRSTR_LEN];
@@ -428,24 +443,9 @@ static void tt_reconnect(bsc *client, bsc_error_t error)
             fail_if( AQ_REAR(client->tubeq) == NULL, 
                 "after reconnect: AQ_REAR(client->tubeq) == NULL");
 
-            fail_if( strcmp(AQ_REAR(client->tubeq)->vec->iov_base, "use baba1\r\n"),
-                "after reconnect: AQ_REAR(client->tubeq) iov_base (%s) != (%s)",
-                AQ_REAR(client->tubeq)->vec->iov_base, "use baba1\r\n");
-            AQ_DEQ_FIN(client->tubeq);
-
-            fail_if( strcmp(AQ_REAR(client->tubeq)->vec->iov_base, "watch baba1\r\n"),
-                "after reconnect: AQ_REAR(client->tubeq) iov_base (%s) != (%s)",
-                AQ_REAR(client->tubeq)->vec->iov_base, "watch baba1\r\n");
-            AQ_DEQ_FIN(client->tubeq);
-
-            fail_if( strcmp(AQ_REAR(client->tubeq)->vec->iov_base, "watch baba2\r\n"),
-                "after reconnect: AQ_REAR(client->tubeq) iov_base (%s) != (%s)",
-                AQ_REAR(client->tubeq)->vec->iov_base, "watch baba2\r\n");
-            AQ_DEQ_FIN(client->tubeq);
-
-            fail_if( strcmp(AQ_REAR(client->tubeq)->vec->iov_base, "ignore default\r\n"),
-                "after reconnect: AQ_REAR(client->tubeq) iov_base (%s) != (%s)",
-                AQ_REAR(client->tubeq)->vec->iov_base, "ignore default\r\n");
+            fail_unless( IOV_EQ(AQ_REAR(client->tubeq)->vec, TT_TUBE_CMDS),
+                "after reconnect: AQ_REAR(client->tubeq) iov_base (%.*s) != (%s)",
+                (int)AQ_REAR(client->tubeq)->vec->iov_len, AQ_REAR(client->tubeq)->vec->iov_base, TT_TUBE_CMDS);
 
             finished++;
             return;
@@ -485,6 +485,1332 @@ START_TEST(tube_test) {
 }
 END_TEST
 
+/*****************************************************************************************************************/ 
+/*                                                      test 5                                                   */
+/*****************************************************************************************************************/ 
+
+static int released = 0;
+
+void release_test_release(void *data, void *ctx)
+{
+    fail_if(data != exp_data, "release: data != exp_data");
+    fail_if(ctx != &released, "release: ctx != &released");
+    ++released;
+}
+
+void release_test_put_cb(bsc *client, struct bsc_put_info *info)
+{
+    fail_if(info->response.code != BSC_PUT_RES_INSERTED, "put_cb: info->code != BSC_PUT_RES_INSERTED");
+    fail_if(released <= finished, "put_cb: data was not released before the response (%d)", released);
+    ++finished;
+}
+
+START_TEST(release_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+
+    client = bsc_new_w_defaults(host, port, "release_test", onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    exp_data = "baba";
+    finished = 0;
+
+    bsc_error = bsc_put_w_release(client, release_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data,
+        release_test_release, &released);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put_w_release failed (%d)", bsc_error);
+    bsc_error = bsc_put_w_release(client, release_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data,
+        release_test_release, &released);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put_w_release failed (%d)", bsc_error);
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 2) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    fail_if(released != 2, "released: %d/%d", released, 2);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 6                                                   */
+/*****************************************************************************************************************/ 
+
+void fd_test_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    fail_if(info->response.bytes != strlen(exp_data),
+        "bsp_reserve: response.bytes != exp_bytes");
+    fail_if(strcmp(info->response.data, exp_data) != 0,
+        "bsp_reserve: got invalid data (%s)", info->response.data);
+
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->response.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+START_TEST(fd_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN], tmpl[] = "/tmp/check_bsc.XXXXXX";
+    size_t queued;
+    int fd;
+
+    client = bsc_new_w_defaults(host, port, "fd_test", onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+
+    fail_if( ( fd = mkstemp(tmpl) ) < 0, "mkstemp failed");
+    unlink(tmpl);
+    fail_unless(write(fd, "--bababuba--", 12) == 12, "write failed");
+    exp_data = "bababuba";
+
+    bsc_error = bsc_watch(client, NULL, NULL, "fd_test");
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_watch failed (%d)", bsc_error );
+    bsc_error = bsc_ignore(client, NULL, NULL, "default");
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_ignore failed (%d)", bsc_error );
+    bsc_error = bsc_put_fd(client, put_cb, NULL, 1, 0, 10, strlen(exp_data), fd, 2, NULL, NULL);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put_fd failed (%d)", bsc_error);
+
+    /* a file is not spliced and a socket is neither spliced nor sent with sendfile */
+    queued = client->cbqueue->used;
+    bsc_error = bsc_put_fd(client, put_cb, NULL, 1, 0, 10, strlen(exp_data), fd, -1, NULL, NULL);
+    fail_if(bsc_error != BSC_ERROR_BAD_FD, "bsc_put_fd of a file without offset (%d)", bsc_error);
+    bsc_error = bsc_put_fd(client, put_cb, NULL, 1, 0, 10, strlen(exp_data), client->fd, -1, NULL, NULL);
+    fail_if(bsc_error != BSC_ERROR_BAD_FD, "bsc_put_fd of a socket (%d)", bsc_error);
+    fail_if(client->cbqueue->used != queued, "rejected puts were queued: %d", (int)client->cbqueue->used);
+    bsc_error = bsc_reserve(client, fd_test_reserve_cb, NULL, -1);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (!finished) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    close(fd);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 7                                                   */
+/*****************************************************************************************************************/ 
+
+static int fills = 0;
+
+int cork_test_fill_cb(bsc *client)
+{
+    return ++fills;
+}
+
+void cork_test_put_cb(bsc *client, struct bsc_put_info *info)
+{
+    fail_if(info->response.code != BSC_PUT_RES_INSERTED, "put_cb: info->code != BSC_PUT_RES_INSERTED");
+    ++finished;
+}
+
+START_TEST(cork_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    int i;
+
+    client = bsc_new_w_defaults(host, port, "cork_test", onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    client->buffer_fill_cb = cork_test_fill_cb;
+    exp_data = "baba";
+    finished = 0;
+
+    bsc_cork(client);
+    for (i = 0; i < 3; ++i) {
+        bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    }
+    fail_if(fills != 0, "buffer_fill_cb called while corked: %d", fills);
+
+    /* nothing is written while corked */
+    bsc_write(client);
+    fail_if(client->tubeq == NULL, "tubeq written while corked");
+    fail_if(client->outq->bytes_written != 0, "outq written while corked: %d", (int)client->outq->bytes_written);
+
+    /* everything fits in the socket buffer, there is nothing left for the host to schedule */
+    bsc_uncork(client);
+    fail_if(client->tubeq != NULL || !AQ_EMPTY(client->outq), "queue not flushed by bsc_uncork");
+    fail_if(fills != 0, "buffer_fill_cb called after a complete flush: %d", fills);
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 3) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 8                                                   */
+/*****************************************************************************************************************/ 
+
+static int above = 0, below = 0;
+
+void watermark_test_cb(bsc *client, bool is_above)
+{
+    if (is_above)
+        ++above;
+    else
+        ++below;
+}
+
+START_TEST(watermark_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    int i;
+
+    client = bsc_new(host, port, "watermark_test", onerror, 2, 16, 4, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    exp_data = "baba";
+    finished = 0;
+
+    /* the write queue does not grow by default */
+    for (i = 0; i < 3; ++i)
+        bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_QUEUE_FULL, "bsc_put beyond buf_len (%d)", bsc_error);
+
+    bsc_set_buffer_limits(client, 64, 10, 2, watermark_test_cb);
+    for (i = 2; i < 64; ++i) {
+        bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put %d failed (%d)", i, bsc_error);
+    }
+    bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_QUEUE_FULL, "bsc_put beyond max_len (%d)", bsc_error);
+    fail_if(client->cbqueue->size != 64, "cbqueue size: %d/%d", (int)client->cbqueue->size, 64);
+    fail_if(above != 1 || below != 0, "watermark callbacks before the responses: %d/%d", above, below);
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 64) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    fail_if(above != 1 || below != 1, "watermark callbacks after the responses: %d/%d", above, below);
+    fail_if(client->cbqueue->size != 2, "cbqueue not shrunk: %d", (int)client->cbqueue->size);
+    bsc_write(client);
+    fail_if(client->outq->size != 6, "outq not shrunk: %d", (int)client->outq->size);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 9                                                   */
+/*****************************************************************************************************************/ 
+
+#define BATCH_JOBS 100
+
+void batch_test_put_batch_cb(bsc *client, struct bsc_put_batch_info *info)
+{
+    size_t i;
+
+    fail_if(info->request.count != BATCH_JOBS, "put_batch_cb: count %d/%d", (int)info->request.count, BATCH_JOBS);
+    fail_if(info->response.inserted != BATCH_JOBS, "put_batch_cb: inserted %d/%d",
+        (int)info->response.inserted, BATCH_JOBS);
+    for (i = 1; i < info->request.count; ++i)
+        fail_if(info->request.jobs[i].response.id <= info->request.jobs[i-1].response.id,
+            "put_batch_cb: job ids out of order");
+    ++finished;
+}
+
+START_TEST(batch_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    static struct bsc_put_job jobs[BATCH_JOBS];
+    int i;
+
+    client = bsc_new(host, port, "batch_test", onerror, 16, 16, 4, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    finished = 0;
+
+    for (i = 0; i < BATCH_JOBS; ++i) {
+        jobs[i].priority = 1;
+        jobs[i].delay    = 0;
+        jobs[i].ttr      = 10;
+        jobs[i].data     = i % 2 ? "baba" : "bababuba";
+        jobs[i].bytes    = strlen(jobs[i].data);
+    }
+
+    bsc_error = bsc_put_batch(client, batch_test_put_batch_cb, NULL, jobs, BATCH_JOBS);
+    fail_if(bsc_error != BSC_ERROR_QUEUE_FULL, "bsc_put_batch beyond buf_len (%d)", bsc_error);
+    fail_if(!AQ_EMPTY(client->cbqueue), "bsc_put_batch queued part of the batch");
+
+    bsc_set_buffer_limits(client, 128, 128, 0, NULL);
+    bsc_error = bsc_put_batch(client, batch_test_put_batch_cb, NULL, jobs, BATCH_JOBS);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put_batch failed (%d)", bsc_error);
+    fail_if(client->cbqueue->used != BATCH_JOBS, "queued commands: %d/%d", (int)client->cbqueue->used, BATCH_JOBS);
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 1) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    fail_if(!AQ_EMPTY(client->cbqueue), "commands left after the batch completed");
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 10                                                  */
+/*****************************************************************************************************************/ 
+
+#define IDS_JOBS 4
+
+static uint64_t ids[IDS_JOBS + 1];
+static int ids_reserved = 0;
+
+void ids_test_cb(bsc *client, struct bsc_ids_info *info)
+{
+    static const bsc_response_t exp_codes[][IDS_JOBS + 1] = {
+        { BSC_TOUCH_RES_TOUCHED, BSC_TOUCH_RES_TOUCHED, BSC_TOUCH_RES_TOUCHED, BSC_TOUCH_RES_TOUCHED },
+        { BSC_RELEASE_RES_RELEASED, BSC_RELEASE_RES_RELEASED },
+        { BSC_RES_BURIED, BSC_RES_BURIED },
+        { BSC_DELETE_RES_DELETED, BSC_DELETE_RES_DELETED, BSC_DELETE_RES_DELETED, BSC_DELETE_RES_DELETED,
+          BSC_RES_NOT_FOUND }
+    };
+    static const enum ids_cmd_e exp_cmds[] = { BSC_IDS_T_TOUCH, BSC_IDS_T_RELEASE, BSC_IDS_T_BURY, BSC_IDS_T_DELETE };
+    size_t i;
+
+    fail_if(info->request.cmd != exp_cmds[finished], "ids_cb: got cmd %d/%d", info->request.cmd, exp_cmds[finished]);
+    fail_if(info->response.count != info->request.count, "ids_cb: responses %d/%d",
+        (int)info->response.count, (int)info->request.count);
+    for (i = 0; i < info->response.count; ++i)
+        fail_if(info->response.codes[i] != exp_codes[finished][i], "ids_cb: cmd %d id %d: code %d/%d",
+            finished, (int)i, info->response.codes[i], exp_codes[finished][i]);
+    fail_if(info->response.succeeded != ( info->request.cmd == BSC_IDS_T_DELETE ? IDS_JOBS : info->request.count ),
+        "ids_cb: succeeded %d", (int)info->response.succeeded);
+    ++finished;
+}
+
+void ids_test_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    ids[ids_reserved++] = info->response.id;
+    if (ids_reserved < IDS_JOBS)
+        return;
+
+    ids[IDS_JOBS] = ids[IDS_JOBS - 1] + 1000;
+    bsc_error = bsc_touch_many(client, ids_test_cb, NULL, ids, IDS_JOBS);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_touch_many failed (%d)", bsc_error);
+    bsc_error = bsc_release_many(client, ids_test_cb, NULL, ids, 2, 1, 0);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_release_many failed (%d)", bsc_error);
+    bsc_error = bsc_bury_many(client, ids_test_cb, NULL, ids + 2, 2, 1);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_bury_many failed (%d)", bsc_error);
+    bsc_error = bsc_delete_many(client, ids_test_cb, NULL, ids, IDS_JOBS + 1);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete_many failed (%d)", bsc_error);
+}
+
+START_TEST(ids_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    int i;
+
+    client = bsc_new_w_defaults(host, port, "ids_test", onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    exp_data = "baba";
+    finished = 0;
+
+    bsc_error = bsc_watch(client, NULL, NULL, "ids_test");
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_watch failed (%d)", bsc_error );
+    bsc_error = bsc_ignore(client, NULL, NULL, "default");
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_ignore failed (%d)", bsc_error );
+    for (i = 0; i < IDS_JOBS; ++i) {
+        bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+        bsc_error = bsc_reserve(client, ids_test_reserve_cb, NULL, -1);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+    }
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 4) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    fail_if(!AQ_EMPTY(client->cbqueue), "commands left after the last response");
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 11                                                  */
+/*****************************************************************************************************************/ 
+
+#define STRESS_JOBS     3000
+#define STRESS_MAX_BODY 5000
+
+#define STRESS_BODY_LEN(i) ( (i) * 37 % STRESS_MAX_BODY )
+
+static char stress_body[STRESS_MAX_BODY + 26];
+static int  stress_released = 0;
+
+/* reads in small chunks and pauses now and then so the client's socket buffer fills up */
+static int stress_server(int lfd)
+{
+    static char buf[2 * STRESS_MAX_BODY + 100];
+    char    response[50];
+    size_t  used = 0, hdr_len, bytes, k;
+    ssize_t bytes_recv;
+    unsigned pri, delay, ttr;
+    int     fd, job = 0, reads = 0;
+    char   *eol;
+
+    if ( ( fd = accept(lfd, NULL, NULL) ) < 0 )
+        return EXIT_FAILURE;
+
+    while ( ( bytes_recv = read(fd, buf + used, used + 97 < sizeof(buf) ? 97 : sizeof(buf) - used) ) > 0 ) {
+        used += bytes_recv;
+        if (++reads % 50 == 0)
+            usleep(1000);
+
+        while ( ( eol = memchr(buf, '\n', used) ) != NULL ) {
+            hdr_len = eol + 1 - buf;
+            if ( sscanf(buf, "put %u %u %u %zu\r\n", &pri, &delay, &ttr, &bytes) != 4
+              || bytes != STRESS_BODY_LEN(job) )
+                return EXIT_FAILURE;
+            if (used < hdr_len + bytes + 2)
+                break;
+            for (k = 0; k < bytes; ++k)
+                if (buf[hdr_len + k] != 'a' + (job + k) % 26)
+                    return EXIT_FAILURE;
+            if (memcmp(buf + hdr_len + bytes, "\r\n", 2) != 0)
+                return EXIT_FAILURE;
+
+            if ( write(fd, response, sprintf(response, "INSERTED %d\r\n", job)) < 0 )
+                return EXIT_FAILURE;
+            ++job;
+            used -= hdr_len + bytes + 2;
+            memmove(buf, buf + hdr_len + bytes + 2, used);
+        }
+    }
+
+    close(fd);
+    return job == STRESS_JOBS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void stress_test_release(void *data, void *ctx)
+{
+    ++stress_released;
+}
+
+void stress_test_put_cb(bsc *client, struct bsc_put_info *info)
+{
+    fail_if(info->response.code != BSC_PUT_RES_INSERTED, "put_cb: info->code != BSC_PUT_RES_INSERTED");
+    fail_if(info->response.id != finished, "put_cb: got id %d/%d", (int)info->response.id, finished);
+    ++finished;
+}
+
+START_TEST(stress_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN], stress_port[10];
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int lfd, sndbuf = 4096, status, i, next = 0, partial = 0;
+    size_t in_flight, written;
+    pid_t pid;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fail_if( ( lfd = socket(AF_INET, SOCK_STREAM, 0) ) < 0, "socket");
+    fail_if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0, "bind");
+    fail_if(listen(lfd, 1) != 0, "listen");
+    fail_if(getsockname(lfd, (struct sockaddr *)&addr, &addr_len) != 0, "getsockname");
+    sprintf(stress_port, "%d", ntohs(addr.sin_port));
+
+    fail_if( ( pid = fork() ) < 0, "fork");
+    if (pid == 0)
+        exit(stress_server(lfd));
+    close(lfd);
+
+    for (i = 0; i < sizeof(stress_body); ++i)
+        stress_body[i] = 'a' + i % 26;
+
+    client = bsc_new("127.0.0.1", stress_port, BSC_DEFAULT_TUBE, onerror, 64, 16, 4, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    fail_if(setsockopt(client->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) != 0, "setsockopt");
+    finished = 0;
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < STRESS_JOBS) {
+        for (; next < STRESS_JOBS; ++next) {
+            if (next % 3)
+                bsc_error = bsc_put(client, stress_test_put_cb, NULL, 1, 0, 10, STRESS_BODY_LEN(next),
+                    stress_body + next % 26, false);
+            else
+                bsc_error = bsc_put_w_release(client, stress_test_put_cb, NULL, 1, 0, 10, STRESS_BODY_LEN(next),
+                    stress_body + next % 26, stress_test_release, NULL);
+            if (bsc_error == BSC_ERROR_QUEUE_FULL)
+                break;
+            fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+        }
+
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+        if ( !AQ_EMPTY(client->outq) && client->outq->bytes_written > 0 )
+            ++partial;
+
+        /* the binary search agrees with a walk over the pending commands */
+        in_flight = bsc_cmds_in_flight(client);
+        for (written = 0; written < client->cbqueue->used
+          && AQ_NTH_(client->cbqueue, written)->out_end <= client->outq->bytes_written; ++written) ;
+        fail_if(in_flight != written, "in flight: %d/%d", (int)in_flight, (int)written);
+    }
+
+    fail_if(partial == 0, "the socket never blocked");
+    fail_if(stress_released != STRESS_JOBS / 3, "released: %d/%d", stress_released, STRESS_JOBS / 3);
+    fail_if(client->outq->bytes_written != client->outq->bytes_queued, "bytes left in the output stream");
+    bsc_free(client);
+
+    fail_if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS,
+        "stress server failed");
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 12                                                  */
+/*****************************************************************************************************************/ 
+
+START_TEST(eager_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+
+    client = bsc_new_w_defaults(host, port, BSC_DEFAULT_TUBE, onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    client->buffer_fill_cb = cork_test_fill_cb;
+    exp_data = "baba";
+    finished = 0;
+    fills = 0;
+
+    /* an idle client writes the put right away */
+    bsc_set_eager_write(client, true);
+    bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    fail_if(!AQ_EMPTY(client->outq), "put not written on enqueue");
+    fail_if(fills != 0, "buffer_fill_cb called for an eager write: %d", fills);
+
+    /* a corked client holds it back */
+    bsc_cork(client);
+    bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    fail_if(AQ_EMPTY(client->outq), "put written while corked");
+    bsc_uncork(client);
+
+    bsc_set_eager_write(client, false);
+    bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    fail_if(AQ_EMPTY(client->outq) || fills != 1, "put written without eager_write");
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 3) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 13                                                  */
+/*****************************************************************************************************************/ 
+
+static int timers = 0;
+static unsigned long timer_usec = 0;
+
+void flush_test_timer_cb(bsc *client, unsigned long usec)
+{
+    ++timers;
+    timer_usec = usec;
+}
+
+START_TEST(flush_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    int i;
+
+    client = bsc_new_w_defaults(host, port, BSC_DEFAULT_TUBE, onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    client->buffer_fill_cb = cork_test_fill_cb;
+    exp_data = "baba";
+    finished = 0;
+    fills = 0;
+
+    /* the first two puts are held back and arm a single timer, the third reaches the command limit */
+    bsc_set_flush_policy(client, 0, 3, 500, flush_test_timer_cb);
+    for (i = 0; i < 2; ++i) {
+        bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    }
+    fail_if(fills != 0, "buffer_fill_cb called for a held back put: %d", fills);
+    fail_if(timers != 1 || timer_usec != 500, "flush timer armed %d times (%lu usec)", timers, timer_usec);
+    bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    fail_if(fills != 1, "buffer_fill_cb not called at the command limit: %d", fills);
+
+    /* the timer flushes what is held back */
+    bsc_flush_timeout(client);
+    fail_if(!AQ_EMPTY(client->outq), "outq not flushed by bsc_flush_timeout");
+    bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    fail_if(fills != 1 || timers != 2, "put not held back after a flush");
+    bsc_flush_timeout(client);
+    fail_if(!AQ_EMPTY(client->outq), "outq not flushed by bsc_flush_timeout");
+
+    /* a put that is larger than the byte limit goes out right away */
+    bsc_set_flush_policy(client, 16, 0, 500, flush_test_timer_cb);
+    bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    fail_if(fills != 2 || timers != 2, "put not flushed at the byte limit");
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 5) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 14                                                  */
+/*****************************************************************************************************************/ 
+
+static const char *take_test_jobs[] = { "first job", "second job", "third job" };
+static char *take_test_bodies[3];
+static void *take_test_bufs[3];
+static int   taken = 0;
+
+void take_test_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    fail_if( ( take_test_bufs[taken] = bsc_job_take(client) ) == NULL, "bsc_job_take failed");
+    fail_if(bsc_job_take(client) != NULL, "bsc_job_take took the same buffer twice");
+    take_test_bodies[taken++] = info->response.data;
+
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->response.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+void take_test_timed_out_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_TIMED_OUT,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_TIMED_OUT");
+    fail_if(bsc_job_take(client) != NULL, "bsc_job_take took the buffer of a response without a body");
+    ++finished;
+}
+
+START_TEST(take_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    int i;
+
+    client = bsc_new_w_defaults(host, port, "take_test", onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    finished = 0;
+
+    /* the reserve responses are likely to arrive in a single read, the later ones are moved along */
+    for (i = 0; i < 3; ++i) {
+        bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, strlen(take_test_jobs[i]), take_test_jobs[i], false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    }
+    for (i = 0; i < 3; ++i) {
+        bsc_error = bsc_reserve(client, take_test_reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+    }
+    /* the tube is empty by then */
+    bsc_error = bsc_reserve(client, take_test_timed_out_cb, NULL, 0);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 4) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < 3; ++i) {
+        fail_if(strcmp(take_test_bodies[i], take_test_jobs[i]) != 0,
+            "taken body %d changed: '%s'", i, take_test_bodies[i]);
+        fail_if(take_test_bufs[i] == client->vec->data, "taken buffer %d still in use", i);
+        free(take_test_bufs[i]);
+    }
+
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 15                                                  */
+/*****************************************************************************************************************/ 
+
+static void drain_test_put_many(bsc *client, int count)
+{
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    }
+    while ( client->tubeq != NULL || !AQ_EMPTY(client->outq) )
+        bsc_write(client);
+
+    /* let all the responses arrive */
+    usleep(200000);
+}
+
+START_TEST(drain_test) {
+    bsc *client;
+    char errorstr[BSC_ERRSTR_LEN];
+
+    /* a small input buffer takes many reads */
+    client = bsc_new(host, port, BSC_DEFAULT_TUBE, onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    exp_data = "baba";
+    finished = 0;
+
+    /* the budget is checked after each read */
+    bsc_set_read_drain(client, true, 0, 10);
+    drain_test_put_many(client, 50);
+    bsc_read(client);
+    fail_if(finished < 10 || finished == 50, "bsc_read did not keep to its budget: %d", finished);
+    fail_if(!BSC_READ_MORE(client), "BSC_READ_MORE not set at the budget");
+    while (BSC_READ_MORE(client))
+        bsc_read(client);
+    fail_if(finished != 50, "bsc_read did not drain the socket: %d", finished);
+
+    bsc_set_read_drain(client, true, 0, 0);
+    drain_test_put_many(client, 50);
+    bsc_read(client);
+    fail_if(finished != 100, "bsc_read did not drain the socket: %d", finished);
+    fail_if(BSC_READ_MORE(client), "BSC_READ_MORE set for a drained socket");
+
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 16                                                  */
+/*****************************************************************************************************************/ 
+
+#define BIG_JOB_SIZE 60000
+
+void big_job_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    fail_if(info->response.bytes != BIG_JOB_SIZE, "bsp_reserve: response.bytes != BIG_JOB_SIZE");
+    fail_if(memcmp(info->response.data, exp_data, BIG_JOB_SIZE) != 0, "bsp_reserve: got invalid data");
+    /* doubling from 64 bytes would have taken 65536 */
+    fail_if(client->vec->size > BIG_JOB_SIZE + 1024, "input buffer not sized by the body: %d", (int)client->vec->size);
+
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->response.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+/* the buffer that replaces a taken one only gets what follows the body */
+void big_job_take_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    void *buf;
+
+    big_job_reserve_cb(client, info);
+    fail_if( ( buf = bsc_job_take(client) ) == NULL, "bsc_job_take failed");
+    fail_if(client->vec->spare_size > 1024, "spare sized by the body: %d", (int)client->vec->spare_size);
+    free(buf);
+}
+
+START_TEST(big_job_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    char *big_job;
+
+    client = bsc_new(host, port, "big_job_test", onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    fail_if( ( big_job = (char *)malloc(BIG_JOB_SIZE) ) == NULL, "out of memory");
+    memset(big_job, 'x', BIG_JOB_SIZE);
+    exp_data = big_job;
+    finished = 0;
+
+    bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, BIG_JOB_SIZE, big_job, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    bsc_error = bsc_reserve(client, big_job_take_cb, NULL, BSC_RESERVE_NO_TIMEOUT);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 1) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    free(big_job);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 17                                                  */
+/*****************************************************************************************************************/ 
+
+START_TEST(compact_test) {
+    bsc *client;
+    char errorstr[BSC_ERRSTR_LEN];
+    int i;
+
+    /* the responses do not line up with the reads, most of them end in a partial message */
+    client = bsc_new(host, port, BSC_DEFAULT_TUBE, onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    exp_data = "baba";
+    finished = 0;
+
+    for (i = 0; i < 10; ++i) {
+        drain_test_put_many(client, 100);
+        while (finished < ( i + 1 ) * 100)
+            bsc_read(client);
+    }
+    fail_if(client->vec->size > 64, "input buffer grew: %d", (int)client->vec->size);
+
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 18                                                  */
+/*****************************************************************************************************************/ 
+
+static char into_test_buf[BIG_JOB_SIZE];
+static int  allocs = 0;
+
+void *into_test_alloc(bsc *client, struct bsc_reserve_info *info, size_t bytes)
+{
+    fail_if(info->response.data != NULL, "alloc got a buffer without a reconnect");
+    ++allocs;
+    return bytes <= sizeof(into_test_buf) ? into_test_buf : NULL;
+}
+
+void into_test_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    fail_if(info->response.data != into_test_buf, "body not placed in the user buffer");
+    fail_if(memcmp(info->response.data, exp_data, info->response.bytes) != 0, "bsp_reserve: got invalid data");
+    fail_if(client->vec->size > 64, "body received into the input buffer: %d", (int)client->vec->size);
+    fail_if(bsc_job_take(client) != NULL, "bsc_job_take took the input buffer of a placed body");
+
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->response.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+START_TEST(into_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    char *big_job;
+    int i;
+
+    client = bsc_new(host, port, "into_test", onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    fail_if( ( big_job = (char *)malloc(BIG_JOB_SIZE) ) == NULL, "out of memory");
+    for (i = 0; i < BIG_JOB_SIZE; ++i)
+        big_job[i] = 'a' + i % 26;
+    exp_data = big_job;
+    finished = 0;
+
+    /* a body that fits in the first read and one that takes many */
+    bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, 10, big_job, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, BIG_JOB_SIZE, big_job, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    for (i = 0; i < 2; ++i) {
+        bsc_error = bsc_reserve_into(client, into_test_reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT, into_test_alloc);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve_into failed (%d)", bsc_error);
+    }
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 2) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+    fail_if(allocs != 2, "alloc called %d times", allocs);
+
+    free(big_job);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 19                                                  */
+/*****************************************************************************************************************/ 
+
+static int spill_test_fd = -1;
+
+void spill_test_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    fail_if(memcmp(info->response.data, exp_data, info->response.bytes) != 0, "bsp_reserve: got invalid data");
+    if (info->response.bytes < 1000)
+        fail_if(info->response.fd != -1, "small body spilled");
+    else {
+        fail_if(info->response.fd == -1, "large body not spilled");
+        fail_if(client->vec->size > 1024, "spilled body received into the input buffer: %d", (int)client->vec->size);
+        spill_test_fd = dup(info->response.fd);
+    }
+
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->response.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+START_TEST(spill_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    char *big_job, *kept;
+    int i;
+
+    client = bsc_new(host, port, "spill_test", onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    fail_if( ( big_job = (char *)malloc(BIG_JOB_SIZE) ) == NULL, "out of memory");
+    fail_if( ( kept = (char *)malloc(BIG_JOB_SIZE) ) == NULL, "out of memory");
+    for (i = 0; i < BIG_JOB_SIZE; ++i)
+        big_job[i] = 'a' + i % 26;
+    exp_data = big_job;
+    finished = 0;
+
+    bsc_set_spill(client, 1000);
+    bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, 10, big_job, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, BIG_JOB_SIZE, big_job, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    for (i = 0; i < 2; ++i) {
+        bsc_error = bsc_reserve(client, spill_test_reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+    }
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 2) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    /* the body outlives the callback through the duplicated descriptor */
+    fail_if(spill_test_fd == -1, "spill file not kept");
+    fail_if(pread(spill_test_fd, kept, BIG_JOB_SIZE, 0) != BIG_JOB_SIZE, "spill file too short");
+    fail_if(memcmp(kept, big_job, BIG_JOB_SIZE) != 0, "spill file changed");
+    close(spill_test_fd);
+
+    free(kept);
+    free(big_job);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 20                                                  */
+/*****************************************************************************************************************/ 
+
+START_TEST(spin_test) {
+    bsc *client;
+    char errorstr[BSC_ERRSTR_LEN];
+    struct timeval start, end;
+
+    client = bsc_new_w_defaults(host, port, "spin_test", onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    exp_data = "baba";
+    finished = 0;
+
+    /* may need CAP_NET_ADMIN, spinning works without it */
+    bsc_set_busy_poll(client, 50);
+
+    /* the tube commands that were sent on connect */
+    while ( client->tubecbq != NULL && !AQ_EMPTY(client->tubecbq) )
+        fail_if(bsc_poll_spin(client, 1000000) == 0, "bsc_poll_spin timed out");
+
+    /* nothing to read, the whole budget is spent */
+    gettimeofday(&start, NULL);
+    fail_if(bsc_poll_spin(client, 20000) != 0, "bsc_poll_spin dispatched a response out of nowhere");
+    gettimeofday(&end, NULL);
+    fail_if( ( end.tv_sec - start.tv_sec ) * 1000000 + end.tv_usec - start.tv_usec < 20000,
+        "bsc_poll_spin returned before its budget");
+
+    /* the put is written and its response dispatched without the event loop */
+    bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    bsc_error = bsc_reserve(client, reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+    while (finished < 1)
+        fail_if(bsc_poll_spin(client, 1000000) == 0, "bsc_poll_spin timed out");
+
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 21                                                  */
+/*****************************************************************************************************************/ 
+
+static int too_large = 0;
+
+void limits_test_bury_cb(bsc *client, struct bsc_bury_info *info)
+{
+    fail_if(info->response.code != BSC_RES_BURIED, "bsp_bury: response.code != BSC_RES_BURIED");
+
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->request.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+void limits_test_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    if (info->response.bytes > 1000) {
+        fail_if(info->response.code != BSC_RES_CLIENT_TOO_LARGE, "large body not discarded: %d", info->response.code);
+        fail_if(info->response.data != NULL, "discarded body passed to the callback");
+        ++too_large;
+        bsc_error = bsc_bury(client, limits_test_bury_cb, NULL, info->response.id, 1);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_bury failed (%d)", bsc_error);
+        return;
+    }
+
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    fail_if(memcmp(info->response.data, exp_data, info->response.bytes) != 0, "bsp_reserve: got invalid data");
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->response.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+START_TEST(limits_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    char *big_job;
+    size_t sizes[] = { BIG_JOB_SIZE, 10, 3000, 500 };
+    int i;
+
+    client = bsc_new(host, port, "limits_test", onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    fail_if( ( big_job = (char *)malloc(BIG_JOB_SIZE) ) == NULL, "out of memory");
+    for (i = 0; i < BIG_JOB_SIZE; ++i)
+        big_job[i] = 'a' + i % 26;
+    exp_data = big_job;
+    finished = 0;
+
+    /* the first body is over body_max, the third does not fit in vec_max, even when spilled */
+    bsc_set_input_limits(client, 1024, 5000);
+    bsc_set_spill(client, 40000);
+    for (i = 0; i < 4; ++i) {
+        bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, sizes[i], big_job, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+        bsc_error = bsc_reserve(client, limits_test_reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+    }
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 4) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+        fail_if(client->vec->size > 1024, "input buffer over its limit: %d", (int)client->vec->size);
+    }
+    fail_if(too_large != 2, "%d bodies discarded", too_large);
+
+    free(big_job);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 22                                                  */
+/*****************************************************************************************************************/ 
+
+START_TEST(trim_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    char *big_job;
+    int i;
+
+    client = bsc_new(host, port, "trim_test", onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    fail_if( ( big_job = (char *)malloc(BIG_JOB_SIZE) ) == NULL, "out of memory");
+    memset(big_job, 'x', BIG_JOB_SIZE);
+    exp_data = big_job;
+    finished = 0;
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    /* the first burst is trimmed by hand, the second one once the client is idle */
+    for (i = 0; i < 2; ++i) {
+        bsc_set_idle_trim(client, i == 1);
+        bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, BIG_JOB_SIZE, big_job, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+        bsc_error = bsc_reserve(client, big_job_reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+        fail_if(bsc_trim(client), "bsc_trim trimmed a busy client");
+
+        while (finished < i + 1) {
+            if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+                return EXIT_FAILURE;
+        }
+        if (i == 0) {
+            fail_if(client->vec->size <= 64, "input buffer did not grow");
+            fail_if(!bsc_trim(client), "bsc_trim failed on an idle client");
+        }
+        fail_if(client->vec->size != 64, "input buffer not trimmed: %d", (int)client->vec->size);
+        fail_if(client->cbqueue->size != BSC_DEFAULT_BUFFER_SIZE, "write queue not trimmed");
+    }
+
+    free(big_job);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 23                                                  */
+/*****************************************************************************************************************/ 
+
+#define URING_TEST_CLIENTS 3
+#define URING_TEST_JOBS    10
+
+void uring_test_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    fail_if(memcmp(info->response.data, exp_data, info->response.bytes) != 0, "bsp_reserve: got invalid data");
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->response.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+START_TEST(uring_test) {
+    bsc_uring *ring;
+    bsc *clients[URING_TEST_CLIENTS];
+    char errorstr[BSC_ERRSTR_LEN];
+    char *big_job;
+    int i, j, runs;
+
+    if ( ( ring = bsc_uring_new(64, errorstr) ) == NULL ) {
+        fprintf(stderr, "uring_test skipped: %s\n", errorstr);
+        return;
+    }
+    fail_if( ( big_job = (char *)malloc(BIG_JOB_SIZE) ) == NULL, "out of memory");
+    for (i = 0; i < BIG_JOB_SIZE; ++i)
+        big_job[i] = 'a' + i % 26;
+    exp_data = big_job;
+    finished = 0;
+
+    /* the jobs (one of them larger than the socket buffers) go to whichever client reserves them */
+    for (i = 0; i < URING_TEST_CLIENTS; ++i) {
+        clients[i] = bsc_new(host, port, "uring_test", onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+        fail_if( clients[i] == NULL, "bsc_new: %s", errorstr);
+        fail_if( !bsc_uring_attach(ring, clients[i]), "bsc_uring_attach failed");
+        for (j = 0; j < URING_TEST_JOBS; ++j) {
+            bsc_error = bsc_put(clients[i], put_cb, NULL, 1, 0, 10,
+                i == 0 && j == 0 ? BIG_JOB_SIZE : j * 1000 + 1, big_job, false);
+            fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+            bsc_error = bsc_reserve(clients[i], uring_test_reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT);
+            fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+        }
+    }
+
+    for (runs = 0; finished < URING_TEST_CLIENTS * URING_TEST_JOBS && runs < 10000; ++runs)
+        fail_if(bsc_uring_run(ring, 1000) < 0, "bsc_uring_run: %s", strerror(errno));
+    fail_if(finished != URING_TEST_CLIENTS * URING_TEST_JOBS, "%d jobs deleted", finished);
+
+    /* an idle client holds no request */
+    fail_if(!bsc_trim(clients[0]), "bsc_trim failed on an idle client");
+    fail_if(clients[0]->vec->size != 64, "input buffer not trimmed");
+
+    /* a client waiting for a response is detached, its read is cancelled */
+    bsc_error = bsc_reserve(clients[1], uring_test_reserve_cb, NULL, 5);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+    fail_if(bsc_uring_run(ring, 0) < 0, "bsc_uring_run: %s", strerror(errno));
+    fail_if(clients[1]->uring_ops == 0, "no request in flight");
+    bsc_uring_detach(clients[1]);
+    fail_if(clients[1]->uring_ops != 0 || clients[1]->uring != NULL, "bsc_uring_detach");
+
+    for (i = 0; i < URING_TEST_CLIENTS; ++i)
+        bsc_free(clients[i]);
+    bsc_uring_free(ring);
+    free(big_job);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 24                                                  */
+/*****************************************************************************************************************/ 
+
+static size_t stream_test_received = 0;
+static int    stream_test_chunks   = 0;
+
+void stream_test_reserve_cb(bsc *client, struct bsc_reserve_info *info)
+{
+    fail_if(info->response.code != BSC_RESERVE_RES_RESERVED,
+        "bsp_reserve: response.code != BSC_RESERVE_RES_RESERVED");
+    fail_if(info->response.data != NULL, "header passed with a body");
+    fail_if(stream_test_received != 0, "header after a chunk");
+}
+
+void stream_test_chunk_cb(bsc *client, struct bsc_reserve_info *info, const char *chunk, size_t len, bool last)
+{
+    fail_if(stream_test_received + len > info->response.bytes, "chunks past the body");
+    fail_if(memcmp(chunk, exp_data + stream_test_received, len) != 0, "got invalid data");
+    fail_if(client->vec->size > 64, "input buffer grew: %d", (int)client->vec->size);
+    stream_test_received += len;
+    ++stream_test_chunks;
+    if (!last)
+        return;
+
+    fail_if(stream_test_received != info->response.bytes, "last chunk at %d bytes", (int)stream_test_received);
+    stream_test_received = 0;
+    bsc_error = bsc_delete(client, delete_cb, NULL, info->response.id);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_delete failed (%d)", bsc_error);
+}
+
+START_TEST(stream_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    char *big_job;
+    size_t sizes[] = { BIG_JOB_SIZE, 0, 10 };
+    int i;
+
+    client = bsc_new(host, port, "stream_test", onerror, BSC_DEFAULT_BUFFER_SIZE, 64, 16, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    fail_if( ( big_job = (char *)malloc(BIG_JOB_SIZE) ) == NULL, "out of memory");
+    for (i = 0; i < BIG_JOB_SIZE; ++i)
+        big_job[i] = 'a' + i % 26;
+    exp_data = big_job;
+    finished = 0;
+
+    /* 
+     * the large body goes through the 64 byte input buffer, the small one arrives with its header.
+     * the empty one ends with its CRLF, the put that follows must not take it for its response.
+     */
+    for (i = 0; i < 3; ++i) {
+        bsc_error = bsc_put(client, put_cb, NULL, 1, 0, 10, sizes[i], big_job, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+        bsc_error = bsc_reserve_stream(client, stream_test_reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT, stream_test_chunk_cb);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve_stream failed (%d)", bsc_error);
+    }
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    while (finished < 3) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+    fail_if(stream_test_chunks < 4, "%d chunks", stream_test_chunks);
+
+    free(big_job);
+    bsc_free(client);
+}
+END_TEST
+
+/*****************************************************************************************************************/ 
+/*                                                      test 25                                                  */
+/*****************************************************************************************************************/ 
+
+static int reentry_released = 0;
+
+/* puts another job while the written one is being retired */
+void reentry_test_release(void *data, void *ctx)
+{
+    bsc *client = (bsc *)ctx;
+
+    fail_if(data != exp_data, "release: data != exp_data");
+    if (reentry_released++ == 0) {
+        bsc_error = bsc_put(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data, false);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put failed (%d)", bsc_error);
+    }
+}
+
+START_TEST(reentry_test) {
+    bsc *client;
+    fd_set readset, writeset;
+    char errorstr[BSC_ERRSTR_LEN];
+    int i;
+
+    client = bsc_new_w_defaults(host, port, "reentry_test", onerror, errorstr);
+    fail_if( client == NULL, "bsc_new: %s", errorstr);
+    exp_data = "baba";
+    finished = 0;
+
+    /* the use command goes out first, an eager write needs an idle client */
+    bsc_write(client);
+    fail_if(client->tubeq != NULL, "tube commands not written");
+
+    bsc_set_eager_write(client, true);
+    bsc_error = bsc_put_w_release(client, cork_test_put_cb, NULL, 1, 0, 10, strlen(exp_data), exp_data,
+        reentry_test_release, client);
+    fail_if(bsc_error != BSC_ERROR_NONE, "bsc_put_w_release failed (%d)", bsc_error);
+    fail_if(reentry_released != 1, "released: %d/%d", reentry_released, 1);
+    fail_if(client->outq->bytes_written != client->outq->bytes_queued, "written: %d/%d",
+        (int)client->outq->bytes_written, (int)client->outq->bytes_queued);
+    fail_if(!AQ_EMPTY(client->outq), "nested put not written");
+
+    for (i = 0; i < 2; ++i) {
+        bsc_error = bsc_reserve(client, reserve_cb, NULL, BSC_RESERVE_NO_TIMEOUT);
+        fail_if(bsc_error != BSC_ERROR_NONE, "bsc_reserve failed (%d)", bsc_error);
+    }
+
+    FD_ZERO(&readset);
+    FD_ZERO(&writeset);
+
+    /* two puts, and two deletes of the reserved jobs */
+    while (finished < 4) {
+        if (client_poll(client, &readset, &writeset) == EXIT_FAILURE)
+            return EXIT_FAILURE;
+    }
+
+    bsc_free(client);
+}
+END_TEST
+
 /*****************************************************************************************************************/ 
 /*                                                  end of tests                                                 */
 /*****************************************************************************************************************/ 
@@ -498,6 +1824,27 @@ Suite *local_suite(void)
     tcase_add_test(tc, commands_test);
     tcase_add_test(tc, reconnect_test);
     tcase_add_test(tc, tube_test);
+    tcase_add_test(tc, release_test);
+    tcase_add_test(tc, fd_test);
+    tcase_add_test(tc, cork_test);
+    tcase_add_test(tc, watermark_test);
+    tcase_add_test(tc, batch_test);
+    tcase_add_test(tc, ids_test);
+    tcase_add_test(tc, stress_test);
+    tcase_add_test(tc, eager_test);
+    tcase_add_test(tc, flush_test);
+    tcase_add_test(tc, take_test);
+    tcase_add_test(tc, drain_test);
+    tcase_add_test(tc, big_job_test);
+    tcase_add_test(tc, compact_test);
+    tcase_add_test(tc, into_test);
+    tcase_add_test(tc, spill_test);
+    tcase_add_test(tc, spin_test);
+    tcase_add_test(tc, limits_test);
+    tcase_add_test(tc, trim_test);
+    tcase_add_test(tc, uring_test);
+    tcase_add_test(tc, stream_test);
+    tcase_add_test(tc, reentry_test);
 
     suite_add_tcase(s, tc);
     return s;
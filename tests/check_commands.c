@@ -19,6 +19,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "beanstalkproto.h"
 
 #define TEST_MSG(func_name, expected, ...)                                                                                     \
@@ -26,17 +27,50 @@ void test_ ##func_name(int _i CK_ATTRIBUTE_UNUSED)
 {                                                                                                                              \
     tcase_fn_start("test_" #func_name, __FILE__, __LINE__);                                                                    \
     {                                                                                                                          \
-        char *msg, *expected_msg = expected;                                                                                   \
+        char *msg, *expected_msg = expected, buf[BSP_CMD_BUF_LEN];                                                             \
         bool is_allocated;                                                                                                     \
         int  msg_len, expected_msg_len = strlen(expected_msg);                                                                 \
-        msg = func_name( &msg_len, &is_allocated, ##__VA_ARGS__ );                                                             \
-        fail_unless( strcmp(msg, expected_msg) == 0, #func_name  " -> got: '%s', expected: '%s'", msg, expected_msg );         \
+        msg = func_name( NULL, &msg_len, &is_allocated, ##__VA_ARGS__ );                                                       \
         fail_unless( msg_len == expected_msg_len, #func_name "(length) -> got %d, expected %d", msg_len, expected_msg_len );   \
+        fail_unless( memcmp(msg, expected_msg, msg_len) == 0,                                                                  \
+            #func_name  " -> got: '%.*s', expected: '%s'", msg_len, msg, expected_msg );                                       \
         if (is_allocated) free(msg);                                                                                           \
+        msg = func_name( buf, &msg_len, &is_allocated, ##__VA_ARGS__ );                                                        \
+        fail_unless( msg_len == expected_msg_len, #func_name "(length) -> got %d, expected %d", msg_len, expected_msg_len );   \
+        fail_unless( memcmp(msg, expected_msg, msg_len) == 0,                                                                  \
+            #func_name  "(buf) -> got: '%.*s', expected: '%s'", msg_len, msg, expected_msg );                                  \
+        fail_if( is_allocated, #func_name "(buf) -> allocated a command that fits the buffer" );                               \
     }                                                                                                                          \
 }                                                                                                                              \
 tcase_add_test(tc, test_ ##func_name);
 
+START_TEST(test_gen_cmd_limits)
+{
+    char *msg, buf[BSP_CMD_BUF_LEN], tube[BSP_CMD_BUF_LEN * 2];
+    bool is_allocated;
+    int  msg_len;
+
+    msg = bsp_gen_put_hdr( buf, &msg_len, &is_allocated, UINT32_MAX, UINT32_MAX, UINT32_MAX, UINT64_MAX );
+    fail_unless( msg == buf && !is_allocated, "bsp_gen_put_hdr -> did not use the buffer" );
+    fail_unless( msg_len == strlen("put 4294967295 4294967295 4294967295 18446744073709551615\r\n")
+        && memcmp(msg, "put 4294967295 4294967295 4294967295 18446744073709551615\r\n", msg_len) == 0,
+        "bsp_gen_put_hdr -> got: '%.*s'", msg_len, msg );
+
+    msg = bsp_gen_release_cmd( buf, &msg_len, &is_allocated, 0, 0, 0 );
+    fail_unless( msg_len == strlen("release 0 0 0\r\n") && memcmp(msg, "release 0 0 0\r\n", msg_len) == 0,
+        "bsp_gen_release_cmd -> got: '%.*s'", msg_len, msg );
+
+    /* a tube name that does not fit the buffer is allocated */
+    memset(tube, 'a', sizeof(tube) - 1);
+    tube[sizeof(tube) - 1] = '\0';
+    msg = bsp_gen_watch_cmd( buf, &msg_len, &is_allocated, tube );
+    fail_unless( msg != buf && is_allocated, "bsp_gen_watch_cmd -> long tube name encoded into the buffer" );
+    fail_unless( msg_len == strlen("watch \r\n") + sizeof(tube) - 1, "bsp_gen_watch_cmd(length) -> got %d", msg_len );
+    fail_unless( memcmp(msg + msg_len - 2, "\r\n", 2) == 0, "bsp_gen_watch_cmd -> missing CRLF" );
+    free(msg);
+}
+END_TEST
+
 Suite *local_suite(void)
 {
     Suite *s  = suite_create(__FILE__);
@@ -65,6 +99,8 @@ Suite *local_suite(void)
     TEST_MSG( bsp_gen_list_tubes_watched_cmd, "list-tubes-watched\r\n" );
     TEST_MSG( bsp_gen_pause_tube_cmd,         "pause-tube baba 2345\r\n", "baba", 2345 );
 
+    tcase_add_test(tc, test_gen_cmd_limits);
+
     suite_add_tcase(s, tc);
     return s;
 }
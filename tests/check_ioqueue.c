@@ -39,6 +39,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <check.h>
 #include "ioqueue.h"
 
@@ -84,20 +89,256 @@ START_TEST(test_ioqueue)
         bytes_expected += IOQ_PEEK_POS(q,i)->iov_len;
 
     fail_unless(bytes_expected == strlen(msg)*3, "IOQ_BYTES_EXPECTED : %d/%d", bytes_expected, strlen(msg)*3);
+    /* both segments of the wrapped ring go out in one call */
     i = ioq_dump(q, 1);
-    fail_if(i != 3, "ioq_write: %d/%d", i, 3);
-    fail_unless(IOQ_NODES_READY(q) == q->used, "IOQ_NODES_READY : %d/%d", IOQ_NODES_READY(q), q->used);
-    fail_if(ioq_dump(q, 1) != 1, "ioq_write (2)");
+    fail_if(i != 4, "ioq_write: %d/%d", i, 4);
     fail_unless(AQ_EMPTY(q), "IOQ_EMPTY : %d/%d", AQ_EMPTY(q), 0);
 }
 END_TEST
 
+START_TEST(test_ioqueue_append)
+{
+    ioq *q = ioq_new(Q_SIZE);
+    char buf[] = "abcdef";
+
+    ioq_enq_append_(q, buf, 2);
+    ioq_enq_append_(q, buf+2, 2);
+    fail_unless(q->used == 1, "contiguous append: %d/%d", q->used, 1);
+    fail_unless(IOQ_REAR_(q)->iov_len == 4, "contiguous append len: %d/%d", IOQ_REAR_(q)->iov_len, 4);
+
+    ioq_truncate_last(q, 2);
+    fail_unless(IOQ_REAR_(q)->iov_len == 2, "truncate len: %d/%d", IOQ_REAR_(q)->iov_len, 2);
+    fail_unless(IOQ_REAR_(q)[q->size].iov_len == 2, "truncate mirror len: %d/%d", IOQ_REAR_(q)[q->size].iov_len, 2);
+    ioq_enq_append_(q, buf+2, 2);
+    fail_unless(q->used == 1 && IOQ_REAR_(q)->iov_len == 4, "append after truncate: %d/%d", IOQ_REAR_(q)->iov_len, 4);
+
+    ioq_enq_append_(q, buf+5, 1);
+    fail_unless(q->used == 2, "gap append: %d/%d", q->used, 2);
+
+    ioq_enq(q, strdup("ghi"), 3, 1);
+    ioq_enq_append_(q, (char *)IOQ_PEEK_POS(q,2)->iov_base + 3, 0);
+    fail_unless(q->used == 4, "append after autofree: %d/%d", q->used, 4);
+
+    ioq_clear(q);
+    fail_unless(AQ_EMPTY(q), "ioq_clear: %d/%d", q->used, 0);
+    ioq_free(q);
+}
+END_TEST
+
+#define DUMP_NODES     3000
+#define DUMP_NODE_LEN  100
+
+START_TEST(test_ioqueue_dump)
+{
+    ioq *q = ioq_new(DUMP_NODES);
+    static char data[DUMP_NODES * DUMP_NODE_LEN], recv_data[DUMP_NODES * DUMP_NODE_LEN];
+    int fds[2], i;
+    ssize_t nodes_written, total_nodes = 0, bytes_recv, total_recv = 0;
+
+    fail_if(pipe(fds) != 0, "pipe");
+    fail_if(fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0, "fcntl");
+    fail_if(fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0, "fcntl");
+
+    for (i = 0; i < sizeof(data); ++i)
+        data[i] = 'a' + i % 26;
+
+    /* wrap the ring around before filling it */
+    ioq_enq(q, data, 0, 0);
+    AQ_DEQ_FIN(q);
+    for (i = 0; i < DUMP_NODES; ++i)
+        fail_unless(ioq_enq(q, data + i * DUMP_NODE_LEN, DUMP_NODE_LEN, 0), "ioq_enq");
+
+    /* more iovecs than IOV_MAX and more bytes than the pipe holds */
+    while (!AQ_EMPTY(q)) {
+        fail_if( ( nodes_written = ioq_dump(q, fds[1]) ) < 0, "ioq_dump: %d", nodes_written);
+        total_nodes += nodes_written;
+        while ( ( bytes_recv = read(fds[0], recv_data + total_recv, sizeof(recv_data) - total_recv) ) > 0 )
+            total_recv += bytes_recv;
+    }
+
+    fail_unless(total_nodes == DUMP_NODES, "nodes written: %d/%d", total_nodes, DUMP_NODES);
+    fail_unless(total_recv == sizeof(data), "bytes recieved: %d/%d", total_recv, sizeof(data));
+    fail_if(memcmp(data, recv_data, sizeof(data)), "data corrupted");
+    fail_unless(ioq_dump(q, fds[1]) == 0, "ioq_dump on empty queue");
+
+    close(fds[0]);
+    close(fds[1]);
+    ioq_free(q);
+}
+END_TEST
+
+static int released;
+
+static void release_cb(void *data, void *ctx)
+{
+    fail_unless(ctx == &released, "release_cb: wrong ctx");
+    ++released;
+}
+
+START_TEST(test_ioqueue_release)
+{
+    ioq *q = ioq_new(Q_SIZE);
+    static char body[100000], sink[100000];
+    int fds[2];
+
+    fail_if(pipe(fds) != 0, "pipe");
+    fail_if(fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0, "fcntl");
+
+    ioq_enq_release_(q, body, sizeof(body), release_cb, &released);
+    ioq_enq_release_(q, body, 1, release_cb, &released);
+    fail_unless(q->bytes_queued == sizeof(body) + 1, "bytes_queued: %d/%d", (int)q->bytes_queued, sizeof(body) + 1);
+
+    /* the pipe can not hold the whole body */
+    fail_unless(ioq_dump(q, fds[1]) == 0, "ioq_dump: partial write completed a node");
+    fail_unless(released == 0, "released before written: %d", released);
+    fail_unless(q->bytes_written > 0 && q->bytes_written < sizeof(body), "bytes_written: %d", (int)q->bytes_written);
+
+    /* dropped nodes are not released */
+    ioq_clear(q);
+    fail_unless(released == 0, "released by ioq_clear: %d", released);
+    fail_unless(q->bytes_queued == q->bytes_written, "bytes_queued after clear: %d/%d", (int)q->bytes_queued, (int)q->bytes_written);
+
+    ioq_enq_release_(q, body, 1, release_cb, &released);
+    ioq_enq_release_(q, body, 1, release_cb, &released);
+    while (read(fds[0], sink, sizeof(sink)) == sizeof(sink)) ;
+    fail_unless(ioq_dump(q, fds[1]) == 2, "ioq_dump");
+    fail_unless(released == 2, "released after write: %d/%d", released, 2);
+
+    ioq_enq_release_(q, body, 1, release_cb, &released);
+    ioq_free(q);
+    fail_unless(released == 3, "released by ioq_free: %d/%d", released, 3);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+END_TEST
+
+START_TEST(test_ioqueue_fd)
+{
+    ioq *q = ioq_new(Q_SIZE * 2);
+    char tmpl[] = "/tmp/check_ioqueue.XXXXXX", recv_data[100];
+    const char exp_data[] = "put 1 0 10 5\r\nbcdef\r\nput 1 0 10 3\r\nxyz\r\n";
+    int fds[2], src[2], file_fd;
+    ssize_t bytes_recv, total_recv = 0;
+
+    fail_if( ( file_fd = mkstemp(tmpl) ) < 0, "mkstemp");
+    unlink(tmpl);
+    fail_unless(write(file_fd, "abcdefgh", 8) == 8, "write");
+    fail_if(pipe(fds) != 0, "pipe");
+    fail_if(pipe(src) != 0, "pipe");
+    fail_unless(write(src[1], "xyz", 3) == 3, "write");
+
+    /* file segments are sent in order between the memory nodes */
+    ioq_enq(q, "put 1 0 10 5\r\n", 14, 0);
+    ioq_enq_fd_(q, file_fd, 1, 5, release_cb, &released);
+    ioq_enq(q, "\r\nput 1 0 10 3\r\n", 16, 0);
+    ioq_enq_fd_(q, src[0], -1, 3, NULL, NULL);
+    ioq_enq(q, "\r\n", 2, 0);
+    fail_unless(AQ_NTH_(q, 1)->fd == file_fd, "fd node");
+
+    released = 0;
+    fail_unless(ioq_dump(q, fds[1]) == 5, "ioq_dump");
+    fail_unless(released == 1, "released: %d/%d", released, 1);
+    fail_unless(q->bytes_written == strlen(exp_data), "bytes_written: %d/%d", (int)q->bytes_written, strlen(exp_data));
+
+    bytes_recv = read(fds[0], recv_data, sizeof(recv_data));
+    fail_unless(bytes_recv == strlen(exp_data) && memcmp(recv_data, exp_data, bytes_recv) == 0,
+        "recieved: %.*s", (int)bytes_recv, recv_data);
+
+    /* a source that ends early is an error (once nothing more can be read) */
+    ioq_enq_fd_(q, file_fd, 6, 5, NULL, NULL);
+    fail_unless(ioq_dump(q, fds[1]) == 0, "ioq_dump on a short file");
+    fail_unless(IOQ_REAR_(q)->iov_len == 3, "ioq_dump on a short file: %d/%d left", IOQ_REAR_(q)->iov_len, 3);
+    fail_unless(ioq_dump(q, fds[1]) == -1, "ioq_dump at the end of a short file");
+
+    close(file_fd);
+    close(src[0]);
+    close(src[1]);
+    close(fds[0]);
+    close(fds[1]);
+    ioq_clear(q);
+    ioq_free(q);
+}
+END_TEST
+
+START_TEST(test_ioqueue_zerocopy)
+{
+    ioq *q = ioq_new(Q_SIZE);
+    static char body[200000], sink[65536];
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    struct pollfd pfd;
+    int lfd, cfd, sfd, one = 1, i;
+    ssize_t bytes_recv, total_recv = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fail_if( ( lfd = socket(AF_INET, SOCK_STREAM, 0) ) < 0, "socket");
+    fail_if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0, "bind");
+    fail_if(listen(lfd, 1) != 0, "listen");
+    fail_if(getsockname(lfd, (struct sockaddr *)&addr, &addr_len) != 0, "getsockname");
+    fail_if( ( cfd = socket(AF_INET, SOCK_STREAM, 0) ) < 0, "socket");
+    fail_if(connect(cfd, (struct sockaddr *)&addr, sizeof(addr)) != 0, "connect");
+    fail_if( ( sfd = accept(lfd, NULL, NULL) ) < 0, "accept");
+    fail_if(fcntl(cfd, F_SETFL, O_NONBLOCK) != 0, "fcntl");
+
+    /* kernels without SO_ZEROCOPY copy the data, there is nothing to check */
+    if ( setsockopt(cfd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0 || !ioq_zerocopy(q, 1000) )
+        goto out;
+
+    released = 0;
+    memset(body, 'z', sizeof(body));
+    ioq_enq(q, "put 1 0 10 200000\r\n", 20, 0);
+    ioq_enq_release_(q, body, sizeof(body), release_cb, &released);
+    ioq_enq_release_(q, body, 10, release_cb, &released);
+
+    /* the small body is copied and released as soon as it is written, the large one waits for its completion */
+    for (i = 0; i < 1000 && ( !AQ_EMPTY(q) || released < 2 ); ++i) {
+        fail_if(ioq_dump(q, cfd) < 0 && !AQ_EMPTY(q), "ioq_dump");
+        fail_if(ioq_zerocopy_reap(q, cfd) < 0, "ioq_zerocopy_reap");
+        pfd.fd     = sfd;
+        pfd.events = POLLIN;
+        while ( poll(&pfd, 1, 10) > 0 && ( bytes_recv = read(sfd, sink, sizeof(sink)) ) > 0 )
+            total_recv += bytes_recv;
+    }
+
+    fail_unless(released == 2, "released: %d/%d", released, 2);
+    fail_unless(AQ_EMPTY(q->zcq), "zerocopy nodes left: %d", (int)q->zcq->used);
+    fail_unless(q->zc_completed >= 1 && q->zc_completed == q->zc_seq, "zc_completed: %d/%d",
+        (int)q->zc_completed, (int)q->zc_seq);
+    fail_unless(total_recv == 20 + sizeof(body) + 10, "bytes recieved: %d/%d", (int)total_recv, 20 + sizeof(body) + 10);
+
+    /* pending nodes of a replaced socket are released by ioq_clear */
+    ioq_enq_release_(q, body, sizeof(body), release_cb, &released);
+    for (i = 0; i < 1000 && !AQ_EMPTY(q); ++i) {
+        fail_if(ioq_dump(q, cfd) < 0 && !AQ_EMPTY(q), "ioq_dump");
+        while ( poll(&pfd, 1, 10) > 0 && read(sfd, sink, sizeof(sink)) > 0 ) ;
+    }
+    fail_unless(released == 2, "released before completion: %d/%d", released, 2);
+    ioq_clear(q);
+    fail_unless(released == 3, "released by ioq_clear: %d/%d", released, 3);
+    fail_unless(q->zc_seq == 0, "zc_seq after clear: %d", (int)q->zc_seq);
+
+out:
+    close(cfd);
+    close(sfd);
+    close(lfd);
+    ioq_free(q);
+}
+END_TEST
+
 Suite *local_suite(void)
 {
     Suite *s  = suite_create(__FILE__);
     TCase *tc = tcase_create("ioqueue");
 
     tcase_add_test(tc, test_ioqueue);
+    tcase_add_test(tc, test_ioqueue_append);
+    tcase_add_test(tc, test_ioqueue_dump);
+    tcase_add_test(tc, test_ioqueue_release);
+    tcase_add_test(tc, test_ioqueue_fd);
+    tcase_add_test(tc, test_ioqueue_zerocopy);
 
     suite_add_tcase(s, tc);
     return s;
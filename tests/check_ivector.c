@@ -33,12 +33,73 @@ START_TEST(test_ivector) {
 }
 END_TEST
 
+START_TEST(test_ivector_take) {
+    char *taken;
+
+    fail_if( (vec = ivector_new(8) ) == NULL, "out of memory");
+    memcpy(vec->data, "abcdefg", 8);
+    vec->eom = vec->data + 7;
+    fail_if( ( taken = ivector_take(vec, 4) ) != vec->data, "ivector_take");
+    fail_if( ivector_take(vec, 4) != NULL, "ivector_take twice");
+    ivector_swap(vec, taken + 4, 3);
+    fail_if( vec->data == taken || vec->spare != NULL, "ivector_swap");
+    fail_if( vec->size != 4, "ivector_swap size: %d", (int)vec->size);
+    fail_if( memcmp(vec->data, "efg", 3) != 0, "got bad data");
+    fail_if( strcmp(taken, "abcdefg") != 0, "taken data changed");
+    free(taken);
+    ivector_free(vec);
+}
+END_TEST
+
+START_TEST(test_ivector_reserve) {
+    fail_if( (vec = ivector_new(8) ) == NULL, "out of memory");
+    memcpy(vec->data, "abcdefg", 8);
+    vec->som = vec->data + 4;
+    vec->eom = vec->data + 7;
+    fail_if( !ivector_reserve(vec, 4) || vec->size != 8, "ivector_reserve grew a large enough vector");
+    fail_if( !ivector_reserve(vec, 100) || vec->size != 104, "ivector_reserve");
+    fail_if( vec->som != vec->data + 4 || vec->eom != vec->data + 7, "ivector_reserve moved som/eom");
+    fail_if( strcmp(vec->som, "efg") != 0, "got bad data");
+    ivector_free(vec);
+}
+END_TEST
+
+START_TEST(test_ivector_compact) {
+    fail_if( (vec = ivector_new(8) ) == NULL, "out of memory");
+    memcpy(vec->data, "abcdefg", 8);
+    vec->som = vec->data + 4;
+    vec->eom = vec->data + 7;
+    ivector_compact(vec);
+    fail_if( vec->som != vec->data || vec->eom != vec->data + 3, "ivector_compact");
+    fail_if( memcmp(vec->som, "efg", 3) != 0, "got bad data");
+    fail_if( IVECTOR_FREE(vec) != 4, "IVECTOR_FREE");
+    ivector_free(vec);
+}
+END_TEST
+
+START_TEST(test_ivector_shrink) {
+    fail_if( (vec = ivector_new(8) ) == NULL, "out of memory");
+    fail_if( !ivector_reserve(vec, 100) || vec->size != 100, "ivector_reserve");
+    vec->eom = vec->data + 3;
+    fail_if( ivector_shrink(vec, 8), "ivector_shrink dropped pending data");
+    vec->som = vec->eom;
+    fail_if( !ivector_shrink(vec, 8) || vec->size != 8, "ivector_shrink");
+    fail_if( vec->som != vec->data || vec->eom != vec->data, "ivector_shrink som/eom");
+    fail_if( !ivector_shrink(vec, 16) || vec->size != 8, "ivector_shrink grew the vector");
+    ivector_free(vec);
+}
+END_TEST
+
 Suite *local_suite(void)
 {
     Suite *s  = suite_create(__FILE__);
     TCase *tc = tcase_create("ivector");
 
     tcase_add_test(tc, test_ivector);
+    tcase_add_test(tc, test_ivector_take);
+    tcase_add_test(tc, test_ivector_reserve);
+    tcase_add_test(tc, test_ivector_compact);
+    tcase_add_test(tc, test_ivector_shrink);
 
     suite_add_tcase(s, tc);
     return s;
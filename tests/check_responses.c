@@ -64,7 +64,7 @@ void test_ ## func_name ## _  ## exp_t(int _i CK_ATTRIBUTE_UNUSED)
     tcase_fn_start("test_" #func_name #exp_t, __FILE__, __LINE__);                                        \
     {                                                                                                     \
         uint64_t id;                                                                                      \
-        uint32_t bytes;                                                                                   \
+        size_t   bytes;                                                                                   \
         bsc_response_t got_t;                                                                             \
         char *input_dup = strdup(test_input);                                                             \
         got_t = func_name( input_dup, &id, &bytes );                                                      \
@@ -78,6 +78,39 @@ void test_ ## func_name ## _  ## exp_t(int _i CK_ATTRIBUTE_UNUSED)
 }                                                                                                         \
 tcase_add_test(tc, test_ ## func_name ## _ ## exp_t);
 
+/* 
+ * framing: the line feeds found in batches match a byte by byte scan, whatever the alignment.
+ * a small max only takes the scalar loop, the vector loops need room for a whole block.
+ */
+START_TEST(test_bsp_scan_lf) {
+    char   data[1024];
+    size_t pos[BSP_LF_BATCH], maxes[] = { 8, 33, BSP_LF_BATCH }, start, scanned, count, i, j, k, m, lines;
+
+    for (i = 0; i < sizeof(data); ++i)
+        data[i] = ( i * 7 ) % 13 == 0 ? '\n' : 'x';
+
+    for (m = 0; m < sizeof(maxes) / sizeof(maxes[0]); ++m) {
+        for (j = 0; j < 64; ++j) {
+            for (start = j, lines = 0; start < sizeof(data); start += scanned) {
+                count = bsp_scan_lf(data + start, sizeof(data) - start, pos, maxes[m], &scanned);
+                fail_unless( count <= maxes[m] && scanned > 0,
+                    "bsp_scan_lf -> found %d in %d bytes", (int)count, (int)scanned );
+                for (i = 0; i < count; ++i)
+                    fail_unless( data[start + pos[i]] == '\n' && ( i == 0 || pos[i] > pos[i - 1] ),
+                        "bsp_scan_lf -> bad offset" );
+                for (i = 0, k = 0; i < scanned; ++i)
+                    k += data[start + i] == '\n';
+                fail_unless( k == count, "bsp_scan_lf(max %d) -> %d of %d line feeds", (int)maxes[m], (int)count, (int)k );
+                lines += count;
+            }
+            for (i = j; i < sizeof(data); ++i)
+                lines -= data[i] == '\n';
+            fail_unless( lines == 0, "bsp_scan_lf -> missed line feeds" );
+        }
+    }
+}
+END_TEST
+
 Suite *local_suite(void)
 {
     Suite *s  = suite_create(__FILE__);
@@ -147,6 +180,8 @@ Suite *local_suite(void)
     TEST_RES(  bsp_get_pause_tube_res,    "PAUSED\r\n",          BSC_PAUSE_TUBE_RES_PAUSED  );
     TEST_RES(  bsp_get_pause_tube_res,    "NOT_FOUND\r\n",       BSC_RES_NOT_FOUND          );
     TEST_RES(  bsp_get_pause_tube_res,    "GIBRISH\r\n",         BSC_RES_UNRECOGNIZED  );
+
+    tcase_add_test(tc, test_bsp_scan_lf);
     suite_add_tcase(s, tc);
 
     return s;